@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+"""Compares b2-bench results against a baseline and flags regressions.
+
+Usage: compare.py baseline.json current.json [--threshold 0.10]
+
+Benchmarks are matched by id and compared by median time. A benchmark slower than the baseline by more than the
+threshold, and by more than the noise of both runs, is a regression; the exit status is 1 if there is any. Metrics, such
+as mesh sizes, are printed along, with the baseline value where it differs.
+"""
+
+import argparse
+import json
+import sys
+
+
+def load(path):
+	with open(path) as stream:
+		results = json.load(stream)
+
+	return results.get("context", {}), {benchmark["id"]: benchmark for benchmark in results["benchmarks"]}
+
+
+def formatMetrics(before, after):
+	previous = before.get("metrics", {}) if before else {}
+	items = []
+
+	for key, value in after.get("metrics", {}).items():
+		if previous.get(key, value) == value:
+			items.append(f"{key} {value:g}")
+		else:
+			items.append(f"{key} {previous[key]:g} -> {value:g}")
+
+	return "  ".join(items)
+
+
+def main():
+	parser = argparse.ArgumentParser(description="Flag b2-bench regressions against a baseline.")
+	parser.add_argument("baseline")
+	parser.add_argument("current")
+	parser.add_argument("--threshold", type=float, default=0.10, help="relative slowdown flagged (default 0.10)")
+	arguments = parser.parse_args()
+
+	baselineContext, baseline = load(arguments.baseline)
+	currentContext, current = load(arguments.current)
+
+	if baselineContext != currentContext:
+		print(f"warning: runs differ in context: {baselineContext} vs {currentContext}", file=sys.stderr)
+
+	regressions = 0
+	width = max((len(id) for id in current), default=0)
+
+	for id, result in current.items():
+		if id not in baseline:
+			print(f"{id:<{width}}        new  {result['medianMs']:10.3f} ms  {formatMetrics(None, result)}".rstrip())
+			continue
+
+		before, after = baseline[id]["medianMs"], result["medianMs"]
+		ratio = after / before if before > 0 else float("inf")
+		noise = (baseline[id]["stddevMs"] + result["stddevMs"]) / before if before > 0 else 0.0
+
+		if ratio > 1.0 + max(arguments.threshold, noise):
+			status = "REGRESSION"
+			regressions += 1
+		elif ratio < 1.0 - max(arguments.threshold, noise):
+			status = "improved"
+		else:
+			status = ""
+
+		metrics = formatMetrics(baseline[id], result)
+
+		print(f"{id:<{width}} {ratio:9.3f}x {before:10.3f} -> {after:10.3f} ms  {status:10}  {metrics}".rstrip())
+
+	for id in baseline.keys() - current.keys():
+		print(f"{id:<{width}}    missing")
+
+	print(f"{regressions} regression(s) over {arguments.threshold:.0%}")
+
+	return 1 if regressions else 0
+
+
+if __name__ == "__main__":
+	sys.exit(main())
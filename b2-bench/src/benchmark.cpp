@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <thread>
+
+#include <b2/logger.hpp>
+
+#include "benchmark.hpp"
+#include "simd.hpp"
+
+namespace b2::bench
+{
+
+std::string Benchmark::getId() const
+{
+	std::string id = name;
+
+	for (const auto &[key, value] : parameters)
+		id += fmt::format("/{}:{}", key, value);
+
+	return id;
+}
+
+Runner::Runner(const RunnerOptions &options) : options(options)
+{}
+
+void Runner::add(Benchmark benchmark)
+{
+	benchmarks.push_back(std::move(benchmark));
+}
+
+std::vector<Result> Runner::run() const
+{
+	std::vector<Result> results;
+
+	for (const auto &benchmark : benchmarks)
+	{
+		const std::string id = benchmark.getId();
+
+		if (id.find(options.filter) == std::string::npos)
+			continue;
+
+		Metrics metrics;
+		const Iteration iteration = benchmark.setup(metrics);
+		std::vector<float> samples;
+		float totalMs = 0.0f;
+
+		for (size_t i = 0; i < options.warmupIterations; ++i)
+			iteration();
+
+		while (samples.size() < options.maxIterations &&
+			   (totalMs < options.minTimeMs || samples.size() < options.minIterations))
+		{
+			samples.push_back(iteration());
+			totalMs += samples.back();
+		}
+
+		std::sort(samples.begin(), samples.end());
+
+		const size_t count = samples.size();
+		const float mean = totalMs / float(count);
+		const float variance = std::accumulate(samples.begin(), samples.end(), 0.0f, [mean](float sum, float sample) {
+			return sum + (sample - mean) * (sample - mean);
+		});
+		Result result;
+
+		result.id = id;
+		result.name = benchmark.name;
+		result.parameters = benchmark.parameters;
+		result.iterationsCount = count;
+		result.itemsCount = benchmark.itemsCount;
+		result.minMs = samples.front();
+		result.medianMs = count % 2 ? samples[count / 2] : (samples[count / 2 - 1] + samples[count / 2]) * 0.5f;
+		result.meanMs = mean;
+		result.stddevMs = std::sqrt(variance / float(count));
+		result.metrics = std::move(metrics);
+
+		std::string line = fmt::format(
+			"{:<72} {:>10.3f} ms median {:>10.3f} ms min {:>6.1f}% dev {:>8} iterations", id, result.medianMs,
+			result.minMs, result.stddevMs * 100.0f / std::max(mean, 1e-6f), count);
+
+		for (const auto &[key, value] : result.metrics)
+			line += fmt::format(" {:>10.8g} {}", value, key);
+
+		info(line);
+		results.push_back(std::move(result));
+	}
+
+	return results;
+}
+
+nlohmann::json toJson(const std::vector<Result> &results)
+{
+	nlohmann::json benchmarks = nlohmann::json::array();
+
+	for (const auto &result : results)
+	{
+		nlohmann::json parameters = nlohmann::json::object();
+
+		for (const auto &[key, value] : result.parameters)
+			parameters[key] = value;
+
+		nlohmann::json metrics = nlohmann::json::object();
+
+		for (const auto &[key, value] : result.metrics)
+			metrics[key] = value;
+
+		benchmarks.push_back({
+			{"id", result.id},
+			{"name", result.name},
+			{"parameters", parameters},
+			{"iterations", result.iterationsCount},
+			{"minMs", result.minMs},
+			{"medianMs", result.medianMs},
+			{"meanMs", result.meanMs},
+			{"stddevMs", result.stddevMs},
+			{"itemsPerSecond", double(result.itemsCount) * 1e3 / std::max(double(result.medianMs), 1e-6)},
+			{"metrics", metrics},
+		});
+	}
+
+	return {
+		{"context",
+		 {{"hardwareThreads", std::thread::hardware_concurrency()},
+		  {"instructionSet", toString(detectInstructionSet())},
+#ifdef NDEBUG
+		  {"build", "release"}}},
+#else
+		  {"build", "debug"}}},
+#endif
+		{"benchmarks", benchmarks}};
+}
+
+} // namespace b2::bench
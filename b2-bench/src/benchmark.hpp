@@ -0,0 +1,72 @@
+#pragma once
+
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <nlohmann/json.hpp>
+
+namespace b2::bench
+{
+
+using Parameters = std::vector<std::pair<std::string, size_t>>;
+// Values a benchmark reports besides its times, such as the size of what it produced, as they stand after its last
+// iteration.
+using Metrics = std::vector<std::pair<std::string, double>>;
+
+// One iteration of a benchmark. Returns the time it measured in milliseconds, so that it can leave out the work that
+// only restores its inputs.
+using Iteration = std::function<float()>;
+
+struct Benchmark
+{
+	// Name followed by the parameters: the key results of two runs are matched by.
+	[[nodiscard]] std::string getId() const;
+
+	std::string name;
+	Parameters parameters;
+	// Items one iteration processes, such as particles or steps, for the throughput.
+	size_t itemsCount = 1;
+	// Builds the state of the benchmark, run once before its iterations. The iterations may keep a reference to the
+	// metrics and fill them in.
+	std::function<Iteration(Metrics &metrics)> setup;
+};
+
+struct Result
+{
+	std::string id, name;
+	Parameters parameters;
+	size_t iterationsCount, itemsCount;
+	float minMs, medianMs, meanMs, stddevMs;
+	Metrics metrics;
+};
+
+struct RunnerOptions
+{
+	// Iterations run until they measured minTimeMs and minIterations, or reach maxIterations.
+	float minTimeMs = 500.0f;
+	size_t minIterations = 5, maxIterations = 10000, warmupIterations = 1;
+	// Only benchmarks whose id contains filter run.
+	std::string filter;
+};
+
+class Runner
+{
+public:
+	explicit Runner(const RunnerOptions &options = {});
+
+	void add(Benchmark benchmark);
+
+	// Runs the matching benchmarks in the order they were added and logs a line per result.
+	[[nodiscard]] std::vector<Result> run() const;
+
+private:
+	RunnerOptions options;
+	std::vector<Benchmark> benchmarks;
+};
+
+// Results with the machine and build they ran on, in the format compare.py reads.
+[[nodiscard]] nlohmann::json toJson(const std::vector<Result> &results);
+
+} // namespace b2::bench
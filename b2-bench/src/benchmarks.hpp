@@ -0,0 +1,17 @@
+#pragma once
+
+#include <vector>
+
+#include "benchmark.hpp"
+#include "fixtures.hpp"
+
+namespace b2::bench
+{
+
+// Passes of ParticleCloud::update() one by one and whole steps, for every scene and thread count.
+void addPhysicsBenchmarks(Runner &runner, const std::vector<Scene> &scenes, const std::vector<size_t> &threadsCounts);
+// Stages of Isosurface::generateMesh() over the settled particles, and whole meshes in both extraction modes.
+void addIsosurfaceBenchmarks(
+	Runner &runner, const std::vector<Scene> &scenes, const std::vector<size_t> &threadsCounts);
+
+} // namespace b2::bench
@@ -0,0 +1,70 @@
+#include <map>
+#include <thread>
+
+#include "fixtures.hpp"
+
+namespace b2::bench
+{
+
+const std::vector<physics::Particle> &getSettledParticles(const Scene &scene)
+{
+	static std::map<std::pair<size_t, size_t>, std::vector<physics::Particle>> cache;
+	auto &particles = cache[{scene.particlesCount, scene.gridWidth}];
+
+	if (!particles.empty())
+		return particles;
+
+	const glm::ivec3 gridSize = getGridSize(scene);
+	const auto threadPool = getThreadPool(std::thread::hardware_concurrency());
+	physics::Options options;
+
+	options.deterministic = true;
+
+	physics::ParticleCloud cloud(
+		gridSize, scene.particlesCount,
+		[gridSize](size_t idx) -> physics::Particle {
+			auto square = gridSize.x * gridSize.y;
+			auto x = (idx % square) % gridSize.x, y = (idx % square) / gridSize.x, z = idx / square;
+
+			return physics::Particle(glm::vec3 {x, z * 2.0f, y} + glm::vec3 {0.5f, 0.5f, 0.5f});
+		},
+		threadPool, options);
+
+	for (size_t i = 0; i < settleSteps; ++i)
+		cloud.update(gravity, timeStep, threadPool == nullptr);
+
+	particles = cloud.getParticles();
+
+	return particles;
+}
+
+std::shared_ptr<ThreadPool> getThreadPool(size_t threadsCount)
+{
+	static std::map<size_t, std::shared_ptr<ThreadPool>> pools;
+
+	if (threadsCount <= 1)
+		return nullptr;
+
+	auto &pool = pools[threadsCount];
+
+	if (pool == nullptr)
+		pool = std::make_shared<ThreadPool>(threadsCount);
+
+	return pool;
+}
+
+physics::ParticleCloud createCloud(const Scene &scene, size_t threadsCount, const physics::Options &options)
+{
+	const std::vector<physics::Particle> &particles = getSettledParticles(scene);
+
+	return physics::ParticleCloud(
+		getGridSize(scene), scene.particlesCount, [&particles](size_t idx) { return particles[idx]; },
+		getThreadPool(threadsCount), options);
+}
+
+glm::ivec3 getGridSize(const Scene &scene)
+{
+	return glm::ivec3(int32_t(scene.gridWidth));
+}
+
+} // namespace b2::bench
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include "physics.hpp"
+#include "threadpool.hpp"
+
+namespace b2::bench
+{
+
+struct Scene
+{
+	size_t particlesCount, gridWidth;
+};
+
+// The initial layout of the particles game in a square grid, after settleSteps steps: piles in contact rather than a
+// falling lattice, which is what the passes spend most of their time on. Computed once per scene.
+[[nodiscard]] const std::vector<physics::Particle> &getSettledParticles(const Scene &scene);
+
+// A pool of threadsCount workers shared by the benchmarks, or none for a single thread.
+[[nodiscard]] std::shared_ptr<ThreadPool> getThreadPool(size_t threadsCount);
+
+// A cloud holding the settled particles of the scene, stepping on getThreadPool(threadsCount).
+[[nodiscard]] physics::ParticleCloud createCloud(
+	const Scene &scene, size_t threadsCount, const physics::Options &options = {});
+
+[[nodiscard]] glm::ivec3 getGridSize(const Scene &scene);
+
+const size_t settleSteps = 200;
+const glm::vec3 gravity(0.0f, -9.81f, 0.0f);
+const float timeStep = 0.01f;
+
+} // namespace b2::bench
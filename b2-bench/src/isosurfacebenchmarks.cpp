@@ -0,0 +1,179 @@
+#include <stdexcept>
+
+#include "benchmarks.hpp"
+#include "isosurface.hpp"
+#include "timer.hpp"
+
+namespace b2::bench
+{
+
+struct IsosurfaceProbe
+{
+	template<uint32_t Radius, typename Particle>
+	static void generateScalarField(
+		Isosurface &isosurface, const std::vector<Particle> &particles, bool singleThread)
+	{
+		isosurface.generateScalarField<Radius>(particles, singleThread);
+	}
+
+	static void classifyBricks(Isosurface &isosurface, bool singleThread)
+	{
+		isosurface.classifyBricks(singleThread);
+	}
+
+	static void generateNormals(Isosurface &isosurface, bool singleThread)
+	{
+		isosurface.generateNormals(singleThread);
+	}
+};
+
+// As in the particles game.
+static const uint32_t radius = 2, margin = (radius + 1) * 2;
+
+// Angle between the vertex normals of the analytic and sampled meshes of the scene, in degrees. Both modes splat the
+// same values, so the meshes share their vertices and only the normals differ. Interpolated normals are not unit
+// length, so both are normalized first.
+static Metrics getAnalyticNormalsError(const Scene &scene, size_t threadsCount)
+{
+	const auto &particles = getSettledParticles(scene);
+	const glm::ivec3 fieldSize = getGridSize(scene) + glm::ivec3(margin);
+	const bool singleThread = threadsCount <= 1;
+	IsosurfaceOptions analyticOptions;
+
+	analyticOptions.normalsMode = NormalsMode::Analytic;
+
+	Isosurface sampled(fieldSize, getThreadPool(threadsCount));
+	Isosurface analytic(fieldSize, getThreadPool(threadsCount), analyticOptions);
+	const auto &expected = sampled.generateMesh<radius>(particles, singleThread).vertices;
+	const auto &actual = analytic.generateMesh<radius>(particles, singleThread).vertices;
+
+	if (expected.size() != actual.size())
+		throw std::runtime_error("Analytic and sampled normals meshes differ in their vertices.");
+
+	double sum = 0.0, max = 0.0;
+
+	for (size_t i = 0; i < expected.size(); ++i)
+	{
+		const float cosine = glm::clamp(
+			glm::dot(glm::normalize(expected[i].normal), glm::normalize(actual[i].normal)), -1.0f, 1.0f);
+		const double angle = glm::degrees(std::acos(cosine));
+
+		sum += angle;
+		max = std::max(max, angle);
+	}
+
+	return {{"meanErrorDegrees", sum / double(std::max<size_t>(expected.size(), 1))}, {"maxErrorDegrees", max}};
+}
+
+void addIsosurfaceBenchmarks(Runner &runner, const std::vector<Scene> &scenes, const std::vector<size_t> &threadsCounts)
+{
+	auto addStage = [&runner](
+						const std::string &name, const Scene &scene, size_t threadsCount,
+						const IsosurfaceOptions &options, auto stage) {
+		runner.add(
+			{"isosurface/" + name,
+			 {{"particles", scene.particlesCount}, {"width", scene.gridWidth}, {"threads", threadsCount}},
+			 scene.particlesCount,
+			 [scene, threadsCount, options, stage](Metrics &metrics) -> Iteration {
+				 const auto &particles = getSettledParticles(scene);
+				 auto isosurface = std::make_shared<Isosurface>(
+					 getGridSize(scene) + glm::ivec3(margin), getThreadPool(threadsCount), options);
+
+				 return [isosurface, &particles, &metrics, stage, singleThread = threadsCount <= 1]() {
+					 return stage(*isosurface, particles, singleThread, metrics);
+				 };
+			 }});
+	};
+
+	IsosurfaceOptions surfaceNets, analyticNormals;
+
+	surfaceNets.extractionMode = ExtractionMode::SurfaceNets;
+	analyticNormals.normalsMode = NormalsMode::Analytic;
+
+	for (const auto &scene : scenes)
+		for (size_t threadsCount : threadsCounts)
+		{
+			addStage(
+				"generateScalarField", scene, threadsCount, {},
+				[](Isosurface &isosurface, const std::vector<physics::Particle> &particles, bool singleThread,
+				   Metrics &) {
+					Timer timer;
+
+					IsosurfaceProbe::generateScalarField<radius>(isosurface, particles, singleThread);
+
+					return timer.getDeltaMs();
+				});
+			// Splatting afresh marks every brick dirty, so the normals of all surface bricks are out of date again.
+			addStage(
+				"generateNormals", scene, threadsCount, {},
+				[](Isosurface &isosurface, const std::vector<physics::Particle> &particles, bool singleThread,
+				   Metrics &) {
+					IsosurfaceProbe::generateScalarField<radius>(isosurface, particles, singleThread);
+					IsosurfaceProbe::classifyBricks(isosurface, singleThread);
+
+					Timer timer;
+
+					IsosurfaceProbe::generateNormals(isosurface, singleThread);
+
+					return timer.getDeltaMs();
+				});
+			// Normals from the splat itself against the splat plus the pass that samples them, which is what the
+			// analytic mode replaces. Classifying the bricks is needed by both and left out.
+			addStage(
+				"normals/sampled", scene, threadsCount, {},
+				[](Isosurface &isosurface, const std::vector<physics::Particle> &particles, bool singleThread,
+				   Metrics &) {
+					Timer splatTimer;
+
+					IsosurfaceProbe::generateScalarField<radius>(isosurface, particles, singleThread);
+
+					const float splatMs = splatTimer.getDeltaMs();
+
+					IsosurfaceProbe::classifyBricks(isosurface, singleThread);
+
+					Timer normalsTimer;
+
+					IsosurfaceProbe::generateNormals(isosurface, singleThread);
+
+					return splatMs + normalsTimer.getDeltaMs();
+				});
+			// The error does not change between iterations, so it is measured once by the setup.
+			runner.add(
+				{"isosurface/normals/analytic",
+				 {{"particles", scene.particlesCount}, {"width", scene.gridWidth}, {"threads", threadsCount}},
+				 scene.particlesCount,
+				 [scene, threadsCount, analyticNormals](Metrics &metrics) -> Iteration {
+					 const auto &particles = getSettledParticles(scene);
+					 auto isosurface = std::make_shared<Isosurface>(
+						 getGridSize(scene) + glm::ivec3(margin), getThreadPool(threadsCount), analyticNormals);
+
+					 metrics = getAnalyticNormalsError(scene, threadsCount);
+
+					 return [isosurface, &particles, singleThread = threadsCount <= 1]() {
+						 Timer timer;
+
+						 IsosurfaceProbe::generateScalarField<radius>(*isosurface, particles, singleThread);
+
+						 return timer.getDeltaMs();
+					 };
+				 }});
+
+			// The mesh size tells apart a faster extractor from one that simply emits less.
+			auto generateMesh = [](Isosurface &isosurface, const std::vector<physics::Particle> &particles,
+								   bool singleThread, Metrics &metrics) {
+				Timer timer;
+
+				const Isosurface::Mesh &mesh = isosurface.generateMesh<radius>(particles, singleThread);
+				const float elapsedMs = timer.getDeltaMs();
+
+				metrics = {{"vertices", double(mesh.vertices.size())}, {"triangles", double(mesh.indices.size() / 3)}};
+
+				return elapsedMs;
+			};
+
+			addStage("generateMesh/marchingCubes", scene, threadsCount, {}, generateMesh);
+			addStage("generateMesh/surfaceNets", scene, threadsCount, surfaceNets, generateMesh);
+		}
+}
+
+} // namespace b2::bench
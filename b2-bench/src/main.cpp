@@ -0,0 +1,109 @@
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+
+#include <b2/logger.hpp>
+
+#include "benchmarks.hpp"
+
+// Usage: b2-bench [--filter text] [--out results.json] [--min-time ms] [--threads 1,2,4]
+//                 [--scenes particles:width,...]
+// Results are compared against a baseline with compare.py.
+int main(int argc, const char **argv)
+{
+	using namespace b2;
+	using namespace b2::bench;
+
+	auto loggerAnchor = Logger::getInstance().setWriteCallback([](const std::string &s) { std::cerr << s; });
+
+	try
+	{
+		const size_t hardwareThreads = std::max(std::thread::hardware_concurrency(), 1u);
+		auto split = [](const std::string &list) {
+			std::vector<std::string> items;
+			std::stringstream stream(list);
+
+			for (std::string item; std::getline(stream, item, ',');)
+				items.push_back(item);
+
+			return items;
+		};
+
+		RunnerOptions options;
+		std::string outPath;
+		std::vector<Scene> scenes = {{32000, 40}, {128000, 80}};
+		std::vector<size_t> threadsCounts = {1, 2, 4, hardwareThreads};
+
+		for (int i = 1; i < argc; i += 2)
+		{
+			if (i + 1 == argc)
+				throw std::runtime_error(fmt::format("Argument '{}' needs a value.", argv[i]));
+
+			const std::string value = argv[i + 1];
+
+			if (std::strcmp(argv[i], "--filter") == 0)
+				options.filter = value;
+			else if (std::strcmp(argv[i], "--out") == 0)
+				outPath = value;
+			else if (std::strcmp(argv[i], "--min-time") == 0)
+				options.minTimeMs = std::stof(value);
+			else if (std::strcmp(argv[i], "--threads") == 0)
+			{
+				threadsCounts.clear();
+
+				for (const auto &item : split(value))
+					threadsCounts.push_back(std::stoul(item));
+			}
+			else if (std::strcmp(argv[i], "--scenes") == 0)
+			{
+				scenes.clear();
+
+				for (const auto &item : split(value))
+				{
+					const size_t colon = item.find(':');
+
+					if (colon == std::string::npos)
+						throw std::runtime_error(fmt::format("Scene '{}' is not particles:width.", item));
+
+					scenes.push_back({std::stoul(item.substr(0, colon)), std::stoul(item.substr(colon + 1))});
+				}
+			}
+			else
+				throw std::runtime_error(fmt::format("Unknown argument '{}'.", argv[i]));
+		}
+
+		// More workers than hardware threads would only measure the scheduler.
+		std::sort(threadsCounts.begin(), threadsCounts.end());
+		threadsCounts.erase(std::unique(threadsCounts.begin(), threadsCounts.end()), threadsCounts.end());
+		std::erase_if(threadsCounts, [hardwareThreads](size_t count) { return count == 0 || count > hardwareThreads; });
+
+		Runner runner(options);
+
+		addPhysicsBenchmarks(runner, scenes, threadsCounts);
+		addIsosurfaceBenchmarks(runner, scenes, threadsCounts);
+
+		const nlohmann::json results = toJson(runner.run());
+
+		if (!outPath.empty())
+		{
+			std::ofstream stream(outPath);
+
+			if (!stream.is_open())
+				throw std::runtime_error(fmt::format("Unable to open file '{}'.", outPath));
+
+			stream << results.dump(1, '\t') << '\n';
+		}
+
+		return 0;
+	}
+	catch (const std::exception &ex)
+	{
+		error(fmt::format("Error occurred: {}", ex.what()));
+
+		return 1;
+	}
+}
@@ -0,0 +1,104 @@
+#include "benchmarks.hpp"
+#include "timer.hpp"
+
+namespace b2::bench
+{
+
+struct PhysicsProbe
+{
+	static void moveParticles(physics::ParticleCloud &cloud, const glm::vec3 &acceleration, bool singleThread)
+	{
+		cloud.moveParticles(acceleration, timeStep, singleThread);
+	}
+
+	static void fill(physics::ParticleCloud &cloud, bool singleThread)
+	{
+		cloud.fill(singleThread);
+	}
+
+	static void resolve(physics::ParticleCloud &cloud, bool singleThread, uint32_t seed)
+	{
+		cloud.resolve(singleThread, seed);
+	}
+
+	static void resolveBounds(physics::ParticleCloud &cloud, bool singleThread)
+	{
+		cloud.resolveBounds(singleThread);
+	}
+};
+
+void addPhysicsBenchmarks(Runner &runner, const std::vector<Scene> &scenes, const std::vector<size_t> &threadsCounts)
+{
+	// Every iteration runs a pass over the same cloud; passes that are not idempotent drift the particles a little,
+	// which does not change their cost.
+	auto addPass = [&runner](
+					   const std::string &name, const Scene &scene, size_t threadsCount,
+					   const physics::Options &options, auto pass) {
+		runner.add(
+			{"physics/" + name,
+			 {{"particles", scene.particlesCount}, {"width", scene.gridWidth}, {"threads", threadsCount}},
+			 scene.particlesCount,
+			 [scene, threadsCount, options, pass](Metrics &) -> Iteration {
+				 auto cloud = std::make_shared<physics::ParticleCloud>(createCloud(scene, threadsCount, options));
+
+				 return [cloud, pass, singleThread = threadsCount <= 1]() mutable {
+					 return pass(*cloud, singleThread);
+				 };
+			 }});
+	};
+
+	physics::Options deterministic;
+
+	deterministic.deterministic = true;
+
+	for (const auto &scene : scenes)
+		for (size_t threadsCount : threadsCounts)
+		{
+			addPass("moveParticles", scene, threadsCount, {}, [](physics::ParticleCloud &cloud, bool singleThread) {
+				Timer timer;
+
+				PhysicsProbe::moveParticles(cloud, glm::vec3(0.0f), singleThread);
+
+				return timer.getDeltaMs();
+			});
+			addPass("resolveBounds", scene, threadsCount, {}, [](physics::ParticleCloud &cloud, bool singleThread) {
+				Timer timer;
+
+				PhysicsProbe::resolveBounds(cloud, singleThread);
+
+				return timer.getDeltaMs();
+			});
+			addPass("fill", scene, threadsCount, {}, [](physics::ParticleCloud &cloud, bool singleThread) {
+				Timer timer;
+
+				PhysicsProbe::fill(cloud, singleThread);
+
+				return timer.getDeltaMs();
+			});
+			// The grid is rebuilt untimed before every resolve, as update() does.
+			addPass(
+				"resolve", scene, threadsCount, {},
+				[seed = uint32_t(0)](physics::ParticleCloud &cloud, bool singleThread) mutable {
+					PhysicsProbe::fill(cloud, singleThread);
+
+					Timer timer;
+
+					PhysicsProbe::resolve(cloud, singleThread, seed++);
+
+					return timer.getDeltaMs();
+				});
+			auto step = [](physics::ParticleCloud &cloud, bool singleThread) {
+				Timer timer;
+
+				cloud.update(gravity, timeStep, singleThread);
+
+				return timer.getDeltaMs();
+			};
+
+			addPass("step", scene, threadsCount, {}, step);
+			// The price of reproducible steps, against the plain step above.
+			addPass("step/deterministic", scene, threadsCount, deterministic, step);
+		}
+}
+
+} // namespace b2::bench
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+namespace b2
+{
+
+constexpr size_t cacheLineSize = 64;
+
+template<typename T, size_t Alignment = cacheLineSize>
+class AlignedAllocator
+{
+public:
+	using value_type = T;
+
+	template<typename U>
+	struct rebind
+	{
+		using other = AlignedAllocator<U, Alignment>;
+	};
+
+	AlignedAllocator() noexcept = default;
+	template<typename U>
+	AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept;
+
+	[[nodiscard]] T *allocate(size_t count);
+	void deallocate(T *pointer, size_t count) noexcept;
+};
+
+template<typename T, size_t Alignment = cacheLineSize>
+using AlignedVector = std::vector<T, AlignedAllocator<T, Alignment>>;
+
+template<typename T, size_t Alignment>
+template<typename U>
+AlignedAllocator<T, Alignment>::AlignedAllocator(const AlignedAllocator<U, Alignment> &) noexcept
+{}
+
+template<typename T, size_t Alignment>
+T *AlignedAllocator<T, Alignment>::allocate(size_t count)
+{
+	return static_cast<T *>(::operator new(count * sizeof(T), std::align_val_t(Alignment)));
+}
+
+template<typename T, size_t Alignment>
+void AlignedAllocator<T, Alignment>::deallocate(T *pointer, size_t count) noexcept
+{
+	::operator delete(pointer, count * sizeof(T), std::align_val_t(Alignment));
+}
+
+template<typename T, typename U, size_t Alignment>
+bool operator==(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &) noexcept
+{
+	return true;
+}
+
+template<typename T, typename U, size_t Alignment>
+bool operator!=(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &) noexcept
+{
+	return false;
+}
+
+} // namespace b2
@@ -1,3 +1,4 @@
+#include <chrono>
 #include <iostream>
 #include <random>
 
@@ -8,6 +9,7 @@
 
 #include "../config.hpp"
 #include "../isosurface.hpp"
+#include "../profiler.hpp"
 #include "../render.hpp"
 #include "../utils.hpp"
 #include "particles.hpp"
@@ -20,10 +22,23 @@ const char *const ParticlesGame::configPath = "configs/game.json";
 ParticlesGame::ParticlesGame(std::shared_ptr<Application> application)
 	: application(application),
 	  acceleration(glm::vec3(0.0f, -9.8f, 0.0f)),
+	  physicsRunning(false),
+	  physicsSteps(0),
+	  physicsThreadTime(0.0f),
+	  previousReorderCount(0),
+	  pipelineDepth(0),
+	  pipelineLatch(std::in_place, 0),
+	  pipelineTask([this]() { runPipeline(); }, &*pipelineLatch),
+	  pipelineStepping(false),
 	  singleThread(true),
 	  materials(render::loadMaterials("materials/")),
+	  renderMode(RenderMode::Points),
 	  projection(1.0f),
-	  elapsed(0.0f)
+	  elapsed(0.0f),
+	  physicsTime(0.0f),
+	  renderTime(0.0f),
+	  framesCount(0),
+	  traceFrames(0)
 {
 	using json = nlohmann::json;
 
@@ -32,38 +47,182 @@ ParticlesGame::ParticlesGame(std::shared_ptr<Application> application)
 
 	singleThread.store(config.json.at("singleThread").get<bool>());
 
+	const json profilerConfig = config.json.at("profiler");
+
+	Profiler::getInstance().setThreadName("Main");
+
+	if (profilerConfig.at("enabled").get<bool>())
+	{
+		traceFrames = profilerConfig.at("frames").get<size_t>() + 1;
+		tracePath = profilerConfig.at("path").get<std::string>();
+		Profiler::getInstance().setEnabled(true);
+	}
+
+	const std::string renderModeName = config.json.at("render").at("mode").get<std::string>();
+
+	if (renderModeName == "surface" || renderModeName == "surfaceNets")
+		renderMode = RenderMode::Surface;
+
+	if (renderModeName == "surfaceNets")
+		isosurfaceOptions.extractionMode = ExtractionMode::SurfaceNets;
+
+	if (config.json.at("render").at("normals").get<std::string>() == "analytic")
+		isosurfaceOptions.normalsMode = NormalsMode::Analytic;
+
+	isosurfaceOptions.incremental = config.json.at("render").at("incremental").get<bool>();
+	isosurfaceOptions.moveThreshold = config.json.at("render").at("moveThreshold").get<float>();
+	isosurfaceOptions.lod = config.json.at("render").at("lod").get<bool>();
+	isosurfaceOptions.lodDistances = glm::vec2(
+		config.json.at("render").at("lodDistances").at(0).get<float>(),
+		config.json.at("render").at("lodDistances").at(1).get<float>());
+	isosurfaceOptions.lodTolerance = config.json.at("render").at("lodTolerance").get<float>();
+
 	if (!singleThread)
-		threadPool = std::make_shared<ThreadPool>();
+	{
+		const json poolConfig = config.json.at("threadPool");
+		ThreadPoolOptions poolOptions;
+
+		poolOptions.spinCount = poolConfig.at("spinCount").get<size_t>();
+		poolOptions.yieldCount = poolConfig.at("yieldCount").get<size_t>();
+		threadPool = std::make_shared<ThreadPool>(std::thread::hardware_concurrency(), poolOptions);
+	}
 
 	const auto surfaceSize = application->getWindowSize();
 
+	physics::Options physicsOptions;
+
+	physicsOptions.resolveMode = physicsConfig.at("resolveMode").get<std::string>() == "batched"
+									 ? physics::ResolveMode::Batched
+									 : physics::ResolveMode::Colored;
+	physicsOptions.reorderInterval = physicsConfig.at("reorderInterval").get<size_t>();
+	physicsOptions.deterministic = physicsConfig.at("deterministic").get<bool>();
+	physicsOptions.seed = physicsConfig.at("seed").get<uint32_t>();
+	physicsOptions.solverIterations = physicsConfig.at("solverIterations").at("initial").get<size_t>();
+
+	StepperOptions stepperOptions;
+
+	stepperOptions.timeStep = physicsConfig.at("timeStep").get<float>();
+	stepperOptions.maxSteps = physicsConfig.at("maxSteps").get<size_t>();
+	stepperOptions.budgetMs = physicsConfig.at("stepBudgetMs").get<float>();
+	stepperOptions.minIterations = physicsConfig.at("solverIterations").at("min").get<size_t>();
+	stepperOptions.maxIterations = physicsConfig.at("solverIterations").at("max").get<size_t>();
+
 	initLogic(
 		surfaceSize, physicsConfig.at("gridSize").at("width").get<size_t>(),
-		physicsConfig.at("particlesCount").get<size_t>());
+		physicsConfig.at("particlesCount").get<size_t>(), physicsOptions);
 	initRender(surfaceSize);
+
+	previousParticles = particlesCloud.getParticles();
+	previousReorderCount = particlesCloud.getReorderCount();
+	stepper = Stepper(stepperOptions);
+
+	pipelineDepth = physicsConfig.at("pipelineDepth").get<size_t>();
+
+	if (pipelineDepth > 0 && (!threadPool || threadPool->getWorkersCount() == 0))
+	{
+		warning("Pipelined loop needs pool workers, running physics and render serially");
+		pipelineDepth = 0;
+	}
+
+	if (physicsConfig.at("threaded").get<bool>())
+	{
+		pipelineDepth = 0;
+		particlesSnapshot = particlesCloud.getParticles();
+		particlesGearbox.turn(particlesSnapshot);
+		physicsRunning.store(true);
+		physicsThread = std::thread(&ParticlesGame::runPhysics, this);
+	}
+}
+
+ParticlesGame::~ParticlesGame()
+{
+	if (physicsThread.joinable())
+	{
+		physicsRunning.store(false);
+		physicsThread.join();
+	}
+
+	// The pool task stops by itself once the ready snapshots fill the pipeline.
+	if (threadPool)
+		threadPool->wait(*pipelineLatch);
 }
 
 void ParticlesGame::update()
 {
-	size_t frames = 0;
-	float pTime = 0.0f, rTime = 0.0f;
+	// The trace covers whole frames, so it is written as the one after the last recorded frame starts.
+	if (traceFrames > 0 && --traceFrames == 0)
+	{
+		Profiler &profiler = Profiler::getInstance();
+
+		profiler.setEnabled(false);
+
+		try
+		{
+			profiler.writeTrace(tracePath);
+			info(fmt::format("Trace written to '{}'", tracePath));
+		}
+		catch (const std::exception &ex)
+		{
+			error(fmt::format("Unable to write the trace: {}", ex.what()));
+		}
+	}
+
+	ProfileZone zone("frame");
 	Timer localTimer;
 
-	updatePhysics();
-	pTime += localTimer.getDeltaMs();
+	if (physicsThread.joinable())
+		presentScene(particlesGearbox.get());
+	else if (pipelineDepth > 0)
+	{
+		// Physics time is only what render had to wait for it.
+		pullSnapshot();
+		physicsTime += localTimer.getDeltaMs();
+		presentScene(drawnSnapshot);
+	}
+	else
+	{
+		stepPhysics(drawnSnapshot);
+		physicsTime += localTimer.getDeltaMs();
+		presentScene(drawnSnapshot);
+	}
 
-	presentScene();
-	rTime += localTimer.getDeltaMs();
+	renderTime += localTimer.getDeltaMs();
 
-	++frames;
+	++framesCount;
 	elapsed += globalTimer.getDeltaMs();
 
 	if (elapsed >= 1000.0f)
 	{
-		info(fmt::format("Physics: {}, Render: {}", pTime / float(frames), rTime / float(frames)));
+		const float frames = float(framesCount);
+
+		if (physicsThread.joinable())
+			physicsTime = physicsThreadTime.exchange(0.0f);
+
+		info(fmt::format(
+			"Physics: {}, {} steps/s, Render: {}", physicsTime / frames, physicsSteps.exchange(0),
+			renderTime / frames));
 
-		frames = 0;
-		elapsed = pTime = rTime = 0.0f;
+		if (renderMode == RenderMode::Surface)
+		{
+			const Isosurface::Mesh &mesh = isosurface.getMesh();
+
+			info(fmt::format("Surface: {} vertices, {} triangles", mesh.vertices.size(), mesh.indices.size() / 3));
+		}
+
+		if (threadPool)
+		{
+			const ThreadPoolStats stats = threadPool->getStats();
+
+			info(fmt::format(
+				"Pool: tasks {}, steals {}, parks {}, idle {:.1f} ms, wake latency {:.1f} us (max {:.1f} us)",
+				stats.tasksCount, stats.stealsCount, stats.parksCount, double(stats.idleTime) * 1e-6,
+				double(stats.wakeLatency) * 1e-3 / double(std::max<uint64_t>(stats.wakeupsCount, 1)),
+				double(stats.maxWakeLatency) * 1e-3));
+			threadPool->resetStats();
+		}
+
+		framesCount = 0;
+		elapsed = physicsTime = renderTime = 0.0f;
 	}
 }
 
@@ -72,7 +231,8 @@ void ParticlesGame::onSensorsEvent(const glm::vec3 &acceleration)
 	this->acceleration.store(acceleration);
 }
 
-void ParticlesGame::initLogic(const glm::ivec2 &surfaceSize, size_t gridWidth, size_t particlesCount)
+void ParticlesGame::initLogic(
+	const glm::ivec2 &surfaceSize, size_t gridWidth, size_t particlesCount, const physics::Options &physicsOptions)
 {
 	assert(gridWidth > 0);
 	assert(particlesCount > 0);
@@ -93,8 +253,8 @@ void ParticlesGame::initLogic(const glm::ivec2 &surfaceSize, size_t gridWidth, s
 
 			return physics::Particle(glm::vec3 {x, z * 2.0f, y} + glm::vec3 {0.5f, 0.5f, 0.5f});
 		},
-		threadPool);
-	//	isosurface = Isosurface(gridSize + glm::ivec3(margin));
+		threadPool, physicsOptions);
+	isosurface = Isosurface(gridSize + glm::ivec3(margin), threadPool, isosurfaceOptions);
 }
 
 void ParticlesGame::initRender(const glm::ivec2 &surfaceSize)
@@ -108,24 +268,19 @@ void ParticlesGame::initRender(const glm::ivec2 &surfaceSize)
 		{{3, sizeof(physics::Particle), render::VertexAttribute::Float},
 		 {3, sizeof(physics::Particle), render::VertexAttribute::Float}},
 		render::BasicMesh::DynamicDraw);
+	isosurfaceMesh = render::IndexedMesh(
+		std::vector<Isosurface::MeshVertex>(), {},
+		{{3, sizeof(Isosurface::MeshVertex), render::VertexAttribute::Float},
+		 {3, sizeof(Isosurface::MeshVertex), render::VertexAttribute::Float}},
+		render::BasicMesh::DynamicDraw);
 
 	this->surfaceSize = surfaceSize;
 }
 
-void ParticlesGame::updatePhysics()
+void ParticlesGame::updatePhysics(float dt)
 try
 {
-	particlesCloud.update(acceleration.load(), 0.01f, singleThread);
-
-	//	ToDo: remove it!
-	static float angle = 0.0f;
-	static Timer timer;
-	auto gravity = glm::vec4 {0.0f, -9.81f, 0.0f, 0.0f};
-	auto transform = glm::rotate(glm::mat4 {1}, angle, glm::vec3 {0.0f, 0.0f, 1.0f});
-
-	gravity = gravity * transform;
-	angle += timer.getDeltaMs() * 0.0001f;
-	acceleration = gravity;
+	particlesCloud.update(acceleration.load(), dt, singleThread);
 }
 catch (const std::exception &ex)
 {
@@ -133,24 +288,162 @@ catch (const std::exception &ex)
 	std::terminate();
 }
 
-void ParticlesGame::presentScene()
+size_t ParticlesGame::stepPhysics(std::vector<physics::Particle> &snapshot)
 {
-	const glm::vec3 boxSize(gridSize /* + glm::ivec3(margin)*/);
-	const auto &particles = particlesCloud.getParticles();
-
-	//	if (!surfaceVertices || surfaceVertices.getSize() < particles.size() * sizeof(physics::Particle))
-	//	{
-	//		surfaceVertices = Buffer(BufferType::Vertex, particles);
-	//	}
-	//	else
-	//	{
-	//		surfaceVertices.bind();
-	//		surfaceVertices.write(0, particles);
-	//	}
-	auto material = materials.get("particles");
-
-	surfaceMesh.update(particles);
-	surfaceMesh.bind();
+	ProfileZone zone("physics/frame");
+
+	const size_t stepsCount = stepper.advance();
+	Timer stepsTimer;
+
+	for (size_t i = 0; i < stepsCount; ++i)
+	{
+		// Render interpolates between the states before and after the latest step.
+		if (i + 1 == stepsCount)
+		{
+			previousParticles = particlesCloud.getParticles();
+			previousReorderCount = particlesCloud.getReorderCount();
+		}
+
+		updatePhysics(stepper.getTimeStep());
+	}
+
+	if (stepsCount > 0)
+	{
+		const float stepsMs = stepsTimer.getDeltaMs();
+
+		particlesCloud.setSolverIterations(
+			stepper.getIterations(stepsMs, stepsCount, particlesCloud.getSolverIterations()));
+		physicsSteps.fetch_add(stepsCount, std::memory_order_relaxed);
+	}
+
+	const std::vector<physics::Particle> &particles = particlesCloud.getParticles();
+	const std::vector<uint32_t> &permutation = particlesCloud.getPermutation();
+	// A reordering in the latest step moved the particles away from their previous indices.
+	const bool reordered = particlesCloud.getReorderCount() != previousReorderCount;
+	const float alpha = stepper.getAlpha();
+
+	// Assigning into a recycled snapshot reuses its storage.
+	snapshot = particles;
+
+	for (size_t i = 0; i < snapshot.size(); ++i)
+		snapshot[i].position =
+			glm::mix(previousParticles[reordered ? permutation[i] : i].position, particles[i].position, alpha);
+
+	return stepsCount;
+}
+
+void ParticlesGame::runPhysics()
+{
+	Profiler::getInstance().setThreadName("Physics");
+
+	while (physicsRunning.load())
+	{
+		Timer stepsTimer;
+
+		// Nothing new to publish until the next step is due.
+		if (stepPhysics(particlesSnapshot) == 0)
+		{
+			std::this_thread::sleep_for(std::chrono::duration<float, std::milli>(stepper.getTimeToStepMs()));
+			continue;
+		}
+
+		physicsThreadTime.fetch_add(stepsTimer.getDeltaMs(), std::memory_order_relaxed);
+
+		particlesGearbox.turn(particlesSnapshot);
+	}
+}
+
+void ParticlesGame::pullSnapshot()
+{
+	std::unique_lock lock(pipelineLock);
+
+	launchPipeline(lock);
+
+	{
+		ProfileZone zone("pipeline/wait");
+
+		pipelineCondition.wait(lock, [this]() { return !readySnapshots.empty(); });
+	}
+
+	freeSnapshots.push_back(std::move(drawnSnapshot));
+	drawnSnapshot = std::move(readySnapshots.front());
+	readySnapshots.pop_front();
+
+	launchPipeline(lock);
+}
+
+void ParticlesGame::runPipeline()
+{
+	for (;;)
+	{
+		std::vector<physics::Particle> snapshot;
+
+		{
+			std::lock_guard lock(pipelineLock);
+
+			if (!freeSnapshots.empty())
+			{
+				snapshot = std::move(freeSnapshots.back());
+				freeSnapshots.pop_back();
+			}
+		}
+
+		// Only this task touches the particles while it runs.
+		stepPhysics(snapshot);
+
+		std::lock_guard lock(pipelineLock);
+
+		readySnapshots.push_back(std::move(snapshot));
+		pipelineCondition.notify_one();
+
+		if (readySnapshots.size() >= pipelineDepth)
+		{
+			pipelineStepping = false;
+			return;
+		}
+	}
+}
+
+void ParticlesGame::launchPipeline(const std::unique_lock<std::mutex> &lock)
+{
+	assert(lock.owns_lock());
+
+	if (pipelineStepping || readySnapshots.size() >= pipelineDepth)
+		return;
+
+	// The previous run may still be counting its latch down after it cleared pipelineStepping. The new latch takes
+	// the same storage, so the task keeps pointing at it.
+	pipelineLatch->wait();
+	pipelineLatch.emplace(1);
+	pipelineStepping = true;
+	// A background task, so the render passes waiting on their own pool work never run physics steps in between.
+	threadPool->pushBackgroundTask(pipelineTask);
+}
+
+void ParticlesGame::presentScene(const std::vector<physics::Particle> &particles)
+{
+	ProfileZone zone("render");
+
+	const bool surface = renderMode == RenderMode::Surface;
+	// The isosurface field is padded by margin cells around the grid.
+	const glm::vec3 boxSize(surface ? gridSize + glm::ivec3(margin) : gridSize);
+	auto material = materials.get(surface ? "surface" : "particles");
+
+	if (surface)
+	{
+		isosurface.setViewPoint(camera.getPosition() + boxSize * 0.5f);
+
+		const Isosurface::Mesh &mesh = isosurface.generateMesh<radius>(particles, singleThread);
+
+		isosurfaceMesh.update(mesh.vertices, mesh.indices);
+		isosurfaceMesh.bind();
+	}
+	else
+	{
+		surfaceMesh.update(particles);
+		surfaceMesh.bind();
+	}
+
 	material->bind();
 
 	render::Uniform("in_projection", projection).set(*material);
@@ -161,7 +454,12 @@ void ParticlesGame::presentScene()
 
 	render::gles3::_i(glClearColor, .5f, .6f, .4f, 1.f);
 	render::gles3::_i(glClear, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-	render::gles3::_i(glDrawArrays, GL_POINTS, 0, particles.size());
+
+	if (surface)
+		render::gles3::_i(
+			glDrawElements, GL_TRIANGLES, GLsizei(isosurfaceMesh.getIndicesCount()), GL_UNSIGNED_INT, nullptr);
+	else
+		render::gles3::_i(glDrawArrays, GL_POINTS, 0, GLsizei(particles.size()));
 
 	application->swapBuffers();
 }
@@ -1,6 +1,11 @@
 #pragma once
 
+#include <condition_variable>
+#include <deque>
+#include <latch>
 #include <mutex>
+#include <optional>
+#include <string>
 #include <thread>
 
 #include <b2/application.hpp>
@@ -11,6 +16,8 @@
 #include "../isosurface.hpp"
 #include "../physics.hpp"
 #include "../render.hpp"
+#include "../stepper.hpp"
+#include "../task.hpp"
 #include "../timer.hpp"
 
 namespace b2::games
@@ -21,35 +28,85 @@ class ParticlesGame : public Game
 public:
 	ParticlesGame(std::shared_ptr<Application> application);
 	ParticlesGame(const ParticlesGame &) = delete;
+	~ParticlesGame() override;
 
 	ParticlesGame &operator=(const ParticlesGame &) = delete;
 
 	void update();
 
+	// Read when each physics step starts. A pipelined loop may already hold pipelineDepth snapshots stepped with the
+	// old value plus the one in flight, so the change shows at most pipelineDepth + 1 frames later.
 	void onSensorsEvent(const glm::vec3 &acceleration);
 
 	static const char *const configPath;
 	static const uint32_t radius = 2, margin = (radius + 1) * 2;
 
 private:
-	using SurfaceMesh = std::vector<Isosurface::MeshVertex>;
-
-	void initLogic(const glm::ivec2 &surfaceSize, size_t gridWidth, size_t particlesCount);
+	enum class RenderMode
+	{
+		Points,
+		Surface
+	};
+
+	void initLogic(
+		const glm::ivec2 &surfaceSize, size_t gridWidth, size_t particlesCount, const physics::Options &physicsOptions);
 	void initRender(const glm::ivec2 &surfaceSize);
-	void updatePhysics();
-	void presentScene();
+	void updatePhysics(float dt);
+	// Runs the steps due by now and writes the particles interpolated between the two latest states into snapshot.
+	// Returns the number of steps run.
+	size_t stepPhysics(std::vector<physics::Particle> &snapshot);
+	// Physics thread routine: steps the simulation and publishes a snapshot of the particles after every step.
+	void runPhysics();
+	// Pipelined loop: takes the oldest ready snapshot, waiting for it if needed, and keeps physics stepping ahead.
+	void pullSnapshot();
+	// Pool task routine: steps the simulation until pipelineDepth snapshots are ready.
+	void runPipeline();
+	// Starts the pool task if it is not running and the ready snapshots are short of pipelineDepth.
+	void launchPipeline(const std::unique_lock<std::mutex> &lock);
+	void presentScene(const std::vector<physics::Particle> &particles);
 
 	std::shared_ptr<Application> application;
 
 	std::atomic<glm::vec3> acceleration;
 
 	physics::ParticleCloud particlesCloud;
-	//	Isosurface isosurface;
+	// Physics runs fixed steps of stepper's time step, as many as the real time elapsed asks for, whatever the frame
+	// rate. previousParticles keeps the state before the latest step to interpolate from.
+	Stepper stepper;
+	std::vector<physics::Particle> previousParticles;
+	size_t previousReorderCount;
+	// With threaded physics, render draws the latest snapshot published through the gearbox and never waits for
+	// physics, which never waits for render either.
+	Gearbox<std::vector<physics::Particle>> particlesGearbox;
+	std::vector<physics::Particle> particlesSnapshot;
+	std::thread physicsThread;
+	std::atomic_bool physicsRunning;
+	std::atomic<size_t> physicsSteps;
+	// Time the physics thread spent stepping since the last log, in milliseconds: render never waits for it, so the
+	// frame timer cannot see it.
+	std::atomic<float> physicsThreadTime;
+	// With a pipelined loop, physics steps run on the pool, at most pipelineDepth frames ahead of the drawn one.
+	// Snapshots are recycled between the ready queue, the drawn one and the free list, so steps do not allocate.
+	size_t pipelineDepth;
+	std::mutex pipelineLock;
+	std::condition_variable pipelineCondition;
+	std::deque<std::vector<physics::Particle>> readySnapshots;
+	std::vector<std::vector<physics::Particle>> freeSnapshots;
+	std::vector<physics::Particle> drawnSnapshot;
+	// The pool task is owned here and queued again on every launch, so the loop does not allocate. Its latch is
+	// re-created on every launch; a released one means the task is not queued or running.
+	std::optional<std::latch> pipelineLatch;
+	Task pipelineTask;
+	bool pipelineStepping;
+	Isosurface isosurface;
+	IsosurfaceOptions isosurfaceOptions;
 
 	std::atomic_bool singleThread;
 	std::shared_ptr<ThreadPool> threadPool;
 
 	render::BasicMesh surfaceMesh;
+	render::IndexedMesh isosurfaceMesh;
+	RenderMode renderMode;
 	//	render::Material material;
 	render::Cache<render::Material> materials;
 
@@ -58,7 +115,12 @@ private:
 	glm::mat4 projection;
 	glm::ivec2 surfaceSize;
 	Timer globalTimer;
-	float elapsed;
+	// Sums over the frames of the current logging second.
+	float elapsed, physicsTime, renderTime;
+	size_t framesCount;
+	// Frames left to record before writing the trace to tracePath, plus one; zero when not tracing.
+	size_t traceFrames;
+	std::string tracePath;
 };
 
 } // namespace b2::games
@@ -1,11 +1,17 @@
 #pragma once
 
-#include <mutex>
-#include <thread>
+#include <atomic>
+#include <cstdint>
+#include <utility>
+
+#include "aligned.hpp"
 
 namespace b2
 {
 
+// Wait-free triple buffer between one producer and one consumer thread. The producer owns one gear, the consumer
+// another, and the third one, the spindle, changes hands through a single atomic exchange, so neither side ever
+// blocks the other. The consumer always gets the latest turned value; values turned in between are skipped.
 template<typename T>
 class Gearbox
 {
@@ -15,41 +21,42 @@ public:
 
 	Gearbox &operator=(const Gearbox &) = delete;
 
+	// Producer side: publishes input and hands back a previously consumed value to reuse.
 	void turn(T &input);
 
+	// Consumer side: the latest published value, valid until the next call.
 	T &get();
 
 private:
-	std::mutex spindleLock;
-	T output, spindle;
-	bool turned;
+	static const uint8_t indexMask = 0x03, turnedFlag = 0x04;
+
+	T gears[3];
+	// Index of the spindle gear, flagged as turned when the producer published it since the consumer last took it.
+	alignas(cacheLineSize) std::atomic<uint8_t> spindle;
+	alignas(cacheLineSize) uint8_t inputGear;
+	alignas(cacheLineSize) uint8_t outputGear;
 };
 
 template<typename T>
-Gearbox<T>::Gearbox(const T &input) : output(input), turned(false)
+Gearbox<T>::Gearbox(const T &input) : gears {input, input, input}, spindle(1), inputGear(2), outputGear(0)
 {}
 
 template<typename T>
 void Gearbox<T>::turn(T &input)
 {
-	std::lock_guard lock(spindleLock);
+	std::swap(gears[inputGear], input);
 
-	std::swap(spindle, input);
-	turned = true;
+	// Releases the gear just written, acquires the one the consumer let go of.
+	inputGear = spindle.exchange(uint8_t(inputGear | turnedFlag), std::memory_order_acq_rel) & indexMask;
 }
 
 template<typename T>
 T &Gearbox<T>::get()
 {
-	std::lock_guard lock(spindleLock);
-
-	if (turned)
-	{
-		std::swap(spindle, output);
-		turned = false;
-	}
+	if (spindle.load(std::memory_order_relaxed) & turnedFlag)
+		outputGear = spindle.exchange(outputGear, std::memory_order_acq_rel) & indexMask;
 
-	return output;
+	return gears[outputGear];
 }
 
 } // namespace b2-core
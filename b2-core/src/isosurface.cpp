@@ -1,51 +1,735 @@
+#include <limits>
+
 #include "isosurface.hpp"
 
 namespace b2
 {
 
-Isosurface::Isosurface(const glm::ivec3 &fieldSize, std::shared_ptr<ThreadPool> threadPool)
-	: field(fieldSize.x * fieldSize.y * fieldSize.z), fieldSize(fieldSize), threadPool(std::move(threadPool))
-{}
+Isosurface::Isosurface(
+	const glm::ivec3 &fieldSize, std::shared_ptr<ThreadPool> threadPool, const IsosurfaceOptions &options)
+	: field(fieldSize.x * fieldSize.y * fieldSize.z),
+	  edgeVertices(field.size() * 3),
+	  fieldSize(fieldSize),
+	  bricksSize((fieldSize + brickSize - 1) / brickSize),
+	  threadPool(std::move(threadPool)),
+	  options(options)
+{
+	const size_t bricksCount = size_t(bricksSize.x) * bricksSize.y * bricksSize.z;
+
+	// Every list is sized for the whole field up front, so frames never allocate whatever the particles do.
+	brickFlags.resize(bricksCount, 0);
+	brickGeometries.resize(bricksCount);
+	brickLevels.resize(bricksCount, options.lod ? invalidLevel : 0);
+	flatLevels.resize(bricksCount, 0);
+	surfaceLevels.reserve(bricksCount);
+
+	for (auto *bricks : {&activeBricks, &dirtyBricks, &affectedBricks, &surfaceBricks, &normalsBricks})
+		bricks->reserve(bricksCount);
+
+	indexOffsets.reserve(bricksCount + 1);
+	vertexOffsets.reserve(bricksCount + 1);
+}
+
+void Isosurface::sortParticles(size_t binsCount, bool singleThread)
+{
+	const size_t particlesCount = particleBins.size(),
+				 chunksCount = std::max<size_t>(1, std::min(size_t(sortChunksCount), particlesCount)),
+				 chunkSize = (particlesCount + chunksCount - 1) / chunksCount;
+
+	binParticles.resize(particlesCount);
+	binCounts.assign(chunksCount * binsCount, 0);
+	binOffsets.resize(binsCount + 1);
+
+	runParallel(chunksCount, 1, singleThread, [&](size_t begin, size_t end) {
+		for (size_t chunk = begin; chunk < end; ++chunk)
+			for (size_t i = chunk * chunkSize; i < std::min(particlesCount, (chunk + 1) * chunkSize); ++i)
+				++binCounts[chunk * binsCount + particleBins[i]];
+	});
+
+	for (size_t bin = 0, sum = 0; bin <= binsCount; ++bin)
+	{
+		binOffsets[bin] = uint32_t(sum);
+
+		for (size_t chunk = 0; bin < binsCount && chunk < chunksCount; ++chunk)
+		{
+			const uint32_t count = binCounts[chunk * binsCount + bin];
+
+			binCounts[chunk * binsCount + bin] = uint32_t(sum);
+			sum += count;
+		}
+	}
+
+	runParallel(chunksCount, 1, singleThread, [&](size_t begin, size_t end) {
+		for (size_t chunk = begin; chunk < end; ++chunk)
+			for (size_t i = chunk * chunkSize; i < std::min(particlesCount, (chunk + 1) * chunkSize); ++i)
+				binParticles[binCounts[chunk * binsCount + particleBins[i]]++] = uint32_t(i);
+	});
+}
+
+void Isosurface::resetBricks(bool dirtyActive)
+{
+	for (uint8_t &flags : brickFlags)
+		flags = uint8_t((dirtyActive && (flags & ActiveBrick) ? DirtyBrick : 0) |
+						(flags & (SurfaceBrick | NormalsValidBrick)));
+}
+
+void Isosurface::zeroBricks(const std::vector<uint32_t> &bricks, bool singleThread)
+{
+	runParallel(bricks.size(), 16, singleThread, [this, &bricks](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const glm::ivec3 first = getBrickCoord(bricks[i]) * brickSize,
+							 last = glm::min(first + brickSize, fieldSize);
+
+			for (int32_t z = first.z; z < last.z; ++z)
+				for (int32_t y = first.y; y < last.y; ++y)
+					for (size_t index = getIndex(first.x, y, z), x = first.x; x < size_t(last.x); ++x, ++index)
+						field[index] = {glm::vec3(0.0f), 0.0f};
+		}
+	});
+}
+
+void Isosurface::collectBricks()
+{
+	activeBricks.clear();
+	dirtyBricks.clear();
+	affectedBricks.clear();
+
+	for (uint32_t brick = 0; brick < brickFlags.size(); ++brick)
+	{
+		if (brickFlags[brick] & ActiveBrick)
+			activeBricks.push_back(brick);
+
+		if (brickFlags[brick] & DirtyBrick)
+			dirtyBricks.push_back(brick);
+	}
+
+	// A brick depends on the values one point past its own: through its last cubes and its gradients.
+	for (uint32_t brick : dirtyBricks)
+	{
+		const glm::ivec3 coord = getBrickCoord(brick), low = glm::max(coord - 1, 0),
+						 high = glm::min(coord + 1, bricksSize - 1);
+
+		for (int32_t z = low.z; z <= high.z; ++z)
+			for (int32_t y = low.y; y <= high.y; ++y)
+				for (int32_t x = low.x; x <= high.x; ++x)
+					brickFlags[getBrickIndex({x, y, z})] |= AffectedBrick;
+	}
+
+	for (uint32_t brick = 0; brick < brickFlags.size(); ++brick)
+		if (brickFlags[brick] & AffectedBrick)
+		{
+			brickFlags[brick] &= uint8_t(~NormalsValidBrick);
+			affectedBricks.push_back(brick);
+		}
+}
+
+void Isosurface::classifyBricks(bool singleThread)
+{
+	ProfileZone zone("isosurface/classify");
+
+	// Cubes of a brick reach one point into the following bricks, so a brick may straddle the threshold as soon as it
+	// or one of them is active. Affected candidates are collected into surfaceBricks and flagged once classified,
+	// then the list is rebuilt from the flags.
+	surfaceBricks.clear();
+
+	for (uint32_t brick : affectedBricks)
+	{
+		const glm::ivec3 coord = getBrickCoord(brick), last = glm::min(coord + 1, bricksSize - 1);
+		bool candidate = false;
+
+		for (int32_t z = coord.z; !candidate && z <= last.z; ++z)
+			for (int32_t y = coord.y; !candidate && y <= last.y; ++y)
+				for (int32_t x = coord.x; !candidate && x <= last.x; ++x)
+					candidate = brickFlags[getBrickIndex({x, y, z})] & ActiveBrick;
+
+		brickFlags[brick] &= uint8_t(~SurfaceBrick);
+
+		if (candidate)
+			surfaceBricks.push_back(brick);
+	}
+
+	// Each task only writes the flags of its own bricks.
+	runParallel(surfaceBricks.size(), 16, singleThread, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const glm::ivec3 first = getBrickCoord(surfaceBricks[i]) * brickSize,
+							 last = glm::min(first + brickSize + 1, fieldSize);
+			float minValue = std::numeric_limits<float>::max(), maxValue = std::numeric_limits<float>::lowest();
+
+			for (int32_t z = first.z; z < last.z; ++z)
+				for (int32_t y = first.y; y < last.y; ++y)
+					for (size_t index = getIndex(first.x, y, z), x = first.x; x < size_t(last.x); ++x, ++index)
+					{
+						minValue = std::min(minValue, field[index].value);
+						maxValue = std::max(maxValue, field[index].value);
+					}
+
+			// Bricks on the far faces have no cubes, their single layer of points only closes the previous bricks.
+			if (glm::all(glm::lessThan(first + 1, fieldSize)) && minValue <= threshold && maxValue > threshold)
+				brickFlags[surfaceBricks[i]] |= SurfaceBrick;
+		}
+	});
+
+	surfaceBricks.clear();
+
+	for (uint32_t brick = 0; brick < brickFlags.size(); ++brick)
+		if (brickFlags[brick] & SurfaceBrick)
+			surfaceBricks.push_back(brick);
+
+	normalsBricks.clear();
+
+	if (options.normalsMode == NormalsMode::Analytic)
+		return;
+
+	for (uint8_t &flags : brickFlags)
+		flags &= uint8_t(~NormalsBrick);
+
+	for (uint32_t brick : surfaceBricks)
+	{
+		const glm::ivec3 coord = getBrickCoord(brick), last = glm::min(coord + 1, bricksSize - 1);
+
+		for (int32_t z = coord.z; z <= last.z; ++z)
+			for (int32_t y = coord.y; y <= last.y; ++y)
+				for (int32_t x = coord.x; x <= last.x; ++x)
+					brickFlags[getBrickIndex({x, y, z})] |= NormalsBrick;
+	}
+
+	// Normals of unaffected bricks still match their values, unless they were not needed when those last changed.
+	for (uint32_t brick = 0; brick < brickFlags.size(); ++brick)
+		if ((brickFlags[brick] & NormalsBrick) && !(brickFlags[brick] & NormalsValidBrick))
+			normalsBricks.push_back(brick);
+}
 
 void Isosurface::generateNormals(bool singleThread)
 {
-	const size_t square = fieldSize.x * fieldSize.y, linearSize = fieldSize.x * square;
+	ProfileZone zone("isosurface/normals");
+
+	auto routine = [this](size_t begin, size_t end) {
+		const size_t steps[3] = {1, size_t(fieldSize.x), size_t(fieldSize.x) * fieldSize.y};
 
-	const size_t workersCount = threadPool->getWorkersCount(), batchSize = linearSize / workersCount;
-	std::future<void> futures[workersCount];
-	auto routine = [this, square](size_t offset, size_t count) {
-		for (size_t i = offset; i < offset + count; ++i)
+		for (size_t i = begin; i < end; ++i)
 		{
-			const int32_t a = i % square;
-			const glm::ivec3 scalarCoord(a % fieldSize.x, a / fieldSize.x, i / square);
-			const glm::vec3 center(scalarCoord);
-			glm::vec3 normal(0.0f);
-
-			for (int32_t z = scalarCoord.z - 1; z <= scalarCoord.z + 1; ++z)
-				for (int32_t y = scalarCoord.y - 1; y <= scalarCoord.y + 1; ++y)
-					for (int32_t x = scalarCoord.x - 1; x <= scalarCoord.x + 1; ++x)
+			const glm::ivec3 first = getBrickCoord(normalsBricks[i]) * brickSize,
+							 last = glm::min(first + brickSize, fieldSize);
+
+			for (int32_t pz = first.z; pz < last.z; ++pz)
+				for (int32_t py = first.y; py < last.y; ++py)
+					for (int32_t px = first.x; px < last.x; ++px)
 					{
-						if (x < 0 || y < 0 || z < 0 || x >= fieldSize.x || y >= fieldSize.y || z >= fieldSize.z)
+						const glm::ivec3 point(px, py, pz);
+						const size_t index = getIndex(px, py, pz);
+						const bool inside = field[index].value > threshold;
+						bool crossed = false;
+
+						// Normals are only read at the ends of crossed edges.
+						for (int32_t axis = 0; !crossed && axis < 3; ++axis)
+							crossed = (point[axis] > 0 && (field[index - steps[axis]].value > threshold) != inside) ||
+									  (point[axis] + 1 < fieldSize[axis] &&
+										  (field[index + steps[axis]].value > threshold) != inside);
+
+						if (!crossed)
 							continue;
 
-						normal += (glm::vec3(x, y, z) - center) *
-								  field[x + y * fieldSize.x + z * fieldSize.x * fieldSize.y].value;
+						const glm::vec3 center(point);
+						glm::vec3 normal(0.0f);
+
+						for (int32_t z = pz - 1; z <= pz + 1; ++z)
+							for (int32_t y = py - 1; y <= py + 1; ++y)
+								for (int32_t x = px - 1; x <= px + 1; ++x)
+								{
+									if (x < 0 || y < 0 || z < 0 || x >= fieldSize.x || y >= fieldSize.y ||
+										z >= fieldSize.z)
+										continue;
+
+									normal += (glm::vec3(x, y, z) - center) * field[getIndex(x, y, z)].value;
+								}
+
+						field[index].normal = glm::normalize(normal);
 					}
 
-			field[i].normal = glm::normalize(normal);
+			brickFlags[normalsBricks[i]] |= NormalsValidBrick;
 		}
 	};
 
-	if (singleThread)
-		routine(0, linearSize);
+	runParallel(normalsBricks.size(), 4, singleThread, routine);
+}
+
+void Isosurface::selectLevels(bool singleThread)
+{
+	ProfileZone zone("isosurface/levels");
+
+	surfaceLevels.resize(surfaceBricks.size());
+
+	runParallel(surfaceBricks.size(), 16, singleThread, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const uint32_t brick = surfaceBricks[i];
+			const glm::ivec3 first = getBrickCoord(brick) * brickSize,
+							 last = glm::min(first + brickSize, fieldSize - 1);
+			const float distance = glm::distance(glm::vec3(first + last) * 0.5f, viewPoint);
+			int32_t level = int32_t(distance > options.lodDistances.x) + int32_t(distance > options.lodDistances.y);
+
+			// Flatness only changes with the values.
+			if (options.lodTolerance > 0.0f && (brickFlags[brick] & AffectedBrick))
+				flatLevels[brick] = uint8_t(getFlatLevel(brick));
+
+			surfaceLevels[i] = uint8_t(std::min(std::max(level, int32_t(flatLevels[brick])), getMaxLevel(brick)));
+		}
+	});
+
+	// Bricks only stop being surface ones when affected. Marking them makes those becoming surface ones again count as
+	// changed, since the polygons around them depend on their level.
+	for (uint32_t brick : affectedBricks)
+		if (!(brickFlags[brick] & SurfaceBrick))
+			brickLevels[brick] = invalidLevel;
+
+	for (size_t i = 0; i < surfaceBricks.size(); ++i)
+	{
+		const uint32_t brick = surfaceBricks[i];
+
+		if (brickLevels[brick] == surfaceLevels[i])
+			continue;
+
+		const glm::ivec3 coord = getBrickCoord(brick), low = glm::max(coord - 1, 0),
+						 high = glm::min(coord + 1, bricksSize - 1);
+
+		brickLevels[brick] = surfaceLevels[i];
+
+		for (int32_t z = low.z; z <= high.z; ++z)
+			for (int32_t y = low.y; y <= high.y; ++y)
+				for (int32_t x = low.x; x <= high.x; ++x)
+					brickFlags[getBrickIndex({x, y, z})] |= AffectedBrick;
+	}
+}
+
+void Isosurface::extractSurface(bool singleThread)
+{
+	ProfileZone zone("isosurface/extract");
+
+	runParallel(surfaceBricks.size(), 4, singleThread, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const uint32_t brick = surfaceBricks[i];
+
+			if (!(brickFlags[brick] & AffectedBrick))
+				continue;
+
+			BrickGeometry &geometry = brickGeometries[brick];
+
+			geometry.vertices.clear();
+			geometry.edges.clear();
+			geometry.corners.clear();
+
+			if (options.extractionMode == ExtractionMode::SurfaceNets)
+				extractSurfaceNets(brick, geometry);
+			else
+				extractMarchingCubes(brick, geometry);
+		}
+	});
+}
+
+void Isosurface::extractMarchingCubes(uint32_t brick, BrickGeometry &geometry) const
+{
+	// Bases of the cubes a brick owns: the last points of the field start no cube.
+	const glm::ivec3 first = getBrickCoord(brick) * brickSize, last = glm::min(first + brickSize, fieldSize - 1);
+	// Bases of the edges a brick owns: those of its cubes, plus the far points of the field, whose edges only the
+	// last cubes use. Every crossed edge is thus owned by a surface brick.
+	const size_t steps[3] = {1, size_t(fieldSize.x), size_t(fieldSize.x) * fieldSize.y};
+	glm::ivec3 lastEdge = last;
+	size_t edgeOffsets[12];
+
+	for (int32_t axis = 0; axis < 3; ++axis)
+		if (last[axis] == fieldSize[axis] - 1)
+			lastEdge[axis] = fieldSize[axis];
+
+	for (int32_t e = 0; e < 12; ++e)
+		edgeOffsets[e] = getIndex(cubeEdgeBases[e].x, cubeEdgeBases[e].y, cubeEdgeBases[e].z) * 3 + cubeEdgeAxes[e];
+
+	for (int32_t z = first.z; z < lastEdge.z; ++z)
+		for (int32_t y = first.y; y < lastEdge.y; ++y)
+			for (int32_t x = first.x; x < lastEdge.x; ++x)
+			{
+				const glm::ivec3 point(x, y, z);
+				const size_t index = getIndex(x, y, z);
+
+				for (int32_t axis = 0; axis < 3; ++axis)
+				{
+					if (point[axis] + 1 >= fieldSize[axis] ||
+						(field[index].value > threshold) == (field[index + steps[axis]].value > threshold))
+						continue;
+
+					MeshVertex vertex = getEdgeCrossing(point, axis);
+
+					// Analytic gradients are accumulated as they are, only the vertex normal is unit length.
+					if (options.normalsMode == NormalsMode::Analytic)
+						vertex.normal = glm::normalize(vertex.normal);
+
+					geometry.vertices.push_back(vertex);
+					geometry.edges.push_back(uint32_t(index * 3 + axis));
+				}
+			}
+
+	for (int32_t z = first.z; z < last.z; ++z)
+		for (int32_t y = first.y; y < last.y; ++y)
+			for (int32_t x = first.x; x < last.x; ++x)
+			{
+				const size_t index = getIndex(x, y, z);
+				const uint8_t config = getCubeConfig(x, y, z);
+
+				for (int32_t t = 0; trianglesTable[config][t] != -1; ++t)
+					geometry.corners.push_back(uint32_t(index * 3 + edgeOffsets[trianglesTable[config][t]]));
+			}
+}
+
+void Isosurface::extractSurfaceNets(uint32_t brick, BrickGeometry &geometry) const
+{
+	const glm::ivec3 coord = getBrickCoord(brick), first = coord * brickSize,
+					 last = glm::min(first + brickSize, fieldSize - 1), low = glm::max(coord - 1, 0),
+					 high = glm::min(coord + 1, bricksSize - 1);
+	const int32_t level = brickLevels[brick], stride = 1 << level;
+	int32_t sidesCount = 1;
+
+	// Among cells of one level, every edge is owned by the cell it is based in. Next to other levels, edges along the
+	// other sides of a cell may be the finest ones around it too.
+	for (int32_t z = low.z; z <= high.z; ++z)
+		for (int32_t y = low.y; y <= high.y; ++y)
+			for (int32_t x = low.x; x <= high.x; ++x)
+			{
+				const uint32_t neighbour = getBrickIndex({x, y, z});
+
+				if ((brickFlags[neighbour] & SurfaceBrick) && brickLevels[neighbour] != level)
+					sidesCount = 4;
+			}
+
+	for (int32_t z = first.z; z < last.z; z += stride)
+		for (int32_t y = first.y; y < last.y; y += stride)
+			for (int32_t x = first.x; x < last.x; x += stride)
+			{
+				const glm::ivec3 base(x, y, z);
+				MeshVertex vertex;
+
+				if (!getCellVertex(base, stride, vertex))
+					continue;
+
+				geometry.vertices.push_back(vertex);
+				geometry.edges.push_back(uint32_t(getIndex(x, y, z)));
+
+				for (int32_t axis = 0; axis < 3; ++axis)
+				{
+					const int32_t u = (axis + 1) % 3, v = (axis + 2) % 3;
+
+					// Quadrants around an edge: ahead along both other axes, behind along u, behind along both, behind
+					// along v. A cell lies in quadrant side of the edge along its side.
+					for (int32_t side = 0; side < sidesCount; ++side)
+					{
+						glm::ivec3 point = base, next;
+
+						point[u] += side == 1 || side == 2 ? stride : 0;
+						point[v] += side >= 2 ? stride : 0;
+						next = point;
+						next[axis] += stride;
+
+						const bool inside = field[getIndex(point.x, point.y, point.z)].value > threshold;
+
+						if (inside == (field[getIndex(next.x, next.y, next.z)].value > threshold))
+							continue;
+
+						uint32_t keys[4];
+						int32_t levels[4];
+						bool owned = true;
+
+						for (int32_t quadrant = 0; owned && quadrant < 4; ++quadrant)
+						{
+							glm::ivec3 probe = point;
+
+							probe[u] -= quadrant == 1 || quadrant == 2 ? 1 : 0;
+							probe[v] -= quadrant >= 2 ? 1 : 0;
+
+							// Edges on the field faces have no polygon, edges of finer cells are shorter.
+							owned = getCell(probe, keys[quadrant], levels[quadrant]) && levels[quadrant] >= level &&
+									(quadrant >= side || levels[quadrant] > level);
+						}
+
+						if (!owned)
+							continue;
+
+						// A larger cell may take two quadrants, leaving a triangle. The polygon faces away from the
+						// side above the threshold, like the marching cubes triangles.
+						uint32_t polygon[4];
+						size_t cornersCount = 0;
+
+						for (int32_t corner = 0; corner < 4; ++corner)
+						{
+							const uint32_t key = keys[inside ? corner : (4 - corner) % 4];
+
+							if (cornersCount == 0 || polygon[cornersCount - 1] != key)
+								polygon[cornersCount++] = key;
+						}
+
+						if (cornersCount > 1 && polygon[cornersCount - 1] == polygon[0])
+							--cornersCount;
+
+						for (size_t corner = 2; corner < cornersCount; ++corner)
+						{
+							geometry.corners.push_back(polygon[0]);
+							geometry.corners.push_back(polygon[corner - 1]);
+							geometry.corners.push_back(polygon[corner]);
+						}
+					}
+				}
+			}
+}
+
+bool Isosurface::getCellVertex(const glm::ivec3 &base, int32_t stride, MeshVertex &vertex) const
+{
+	glm::vec3 position(0.0f), normal(0.0f);
+	int32_t crossingsCount = 0;
+
+	auto addCrossing = [&](const glm::ivec3 &point, int32_t axis) {
+		const MeshVertex crossing = getEdgeCrossing(point, axis);
+
+		position += crossing.position;
+		normal += crossing.normal;
+		++crossingsCount;
+	};
+
+	if (stride == 1)
+	{
+		const int32_t edges = edgesTable[getCubeConfig(base.x, base.y, base.z)];
+
+		for (int32_t e = 0; e < 12; ++e)
+			if (edges & (1 << e))
+				addCrossing(base + cubeEdgeBases[e], cubeEdgeAxes[e]);
+	}
 	else
 	{
-		for (int32_t t = 0; t < workersCount; ++t)
-			futures[t] = threadPool->pushTask(routine, t * batchSize, batchSize);
+		// Edges inside a larger cell are left out: its vertex only has to exist whenever an edge on its faces is
+		// crossed, the finer cells next to it connecting to it through those.
+		const size_t steps[3] = {1, size_t(fieldSize.x), size_t(fieldSize.x) * fieldSize.y};
+
+		for (int32_t z = 0; z <= stride; ++z)
+			for (int32_t y = 0; y <= stride; ++y)
+				for (int32_t x = 0; x <= stride; ++x)
+				{
+					const glm::ivec3 offset(x, y, z), point = base + offset;
+					const size_t index = getIndex(point.x, point.y, point.z);
+
+					for (int32_t axis = 0; axis < 3; ++axis)
+					{
+						const int32_t u = offset[(axis + 1) % 3], v = offset[(axis + 2) % 3];
+
+						if (offset[axis] == stride || (u % stride != 0 && v % stride != 0) ||
+							(field[index].value > threshold) == (field[index + steps[axis]].value > threshold))
+							continue;
 
-		for (auto &future : futures)
-			future.wait();
+						addCrossing(point, axis);
+					}
+				}
 	}
+
+	if (crossingsCount == 0)
+		return false;
+
+	vertex = {position / float(crossingsCount), glm::normalize(normal)};
+
+	return true;
+}
+
+bool Isosurface::getCell(const glm::ivec3 &point, uint32_t &key, int32_t &level) const
+{
+	if (glm::any(glm::lessThan(point, glm::ivec3(0))) || glm::any(glm::greaterThan(point, fieldSize - 2)))
+		return false;
+
+	const uint32_t brick = getBrickIndex(point / brickSize);
+
+	if (brickLevels[brick] == invalidLevel)
+		return false;
+
+	const glm::ivec3 base = (point >> int32_t(brickLevels[brick])) << int32_t(brickLevels[brick]);
+
+	key = uint32_t(getIndex(base.x, base.y, base.z));
+	level = brickLevels[brick];
+
+	return true;
+}
+
+void Isosurface::assembleMesh(bool singleThread)
+{
+	ProfileZone zone("isosurface/assemble");
+
+	const size_t bricksCount = surfaceBricks.size();
+
+	indexOffsets.resize(bricksCount + 1);
+	vertexOffsets.resize(bricksCount + 1);
+	indexOffsets[0] = vertexOffsets[0] = 0;
+
+	for (size_t i = 0; i < bricksCount; ++i)
+	{
+		const BrickGeometry &geometry = brickGeometries[surfaceBricks[i]];
+
+		indexOffsets[i + 1] = indexOffsets[i] + geometry.corners.size();
+		vertexOffsets[i + 1] = vertexOffsets[i] + geometry.vertices.size();
+	}
+
+	// Shrinking keeps the capacity, so after warm-up this only allocates when the surface outgrows every earlier one.
+	mesh.vertices.resize(vertexOffsets[bricksCount]);
+	mesh.indices.resize(indexOffsets[bricksCount]);
+
+	// edgeVertices is never cleared: only edges crossed on this frame are written here and read below.
+	runParallel(bricksCount, 4, singleThread, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const BrickGeometry &geometry = brickGeometries[surfaceBricks[i]];
+
+			std::copy(geometry.vertices.begin(), geometry.vertices.end(), mesh.vertices.begin() + vertexOffsets[i]);
+
+			for (size_t j = 0; j < geometry.edges.size(); ++j)
+				edgeVertices[geometry.edges[j]] = uint32_t(vertexOffsets[i] + j);
+		}
+	});
+
+	runParallel(bricksCount, 4, singleThread, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const std::vector<uint32_t> &corners = brickGeometries[surfaceBricks[i]].corners;
+			uint32_t *output = mesh.indices.data() + indexOffsets[i];
+
+			for (uint32_t edge : corners)
+				*output++ = edgeVertices[edge];
+		}
+	});
+}
+
+const Isosurface::Mesh &Isosurface::getMesh() const
+{
+	return mesh;
+}
+
+void Isosurface::setViewPoint(const glm::vec3 &point)
+{
+	viewMoved = viewMoved || (options.lod && point != viewPoint);
+	viewPoint = point;
+}
+
+int32_t Isosurface::getMaxLevel(uint32_t brick) const
+{
+	const glm::ivec3 first = getBrickCoord(brick) * brickSize,
+					 size = glm::min(first + brickSize, fieldSize - 1) - first;
+	int32_t level = maxLevel;
+
+	while (level > 0 && ((size.x | size.y | size.z) & ((1 << level) - 1)) != 0)
+		--level;
+
+	return level;
+}
+
+int32_t Isosurface::getFlatLevel(uint32_t brick) const
+{
+	const glm::ivec3 first = getBrickCoord(brick) * brickSize, last = glm::min(first + brickSize, fieldSize - 1);
+
+	// How far the surface moves at a point is about the change of its value over the gradient length. Only points
+	// around the threshold count, values deep inside the fluid or far out of it do not shape the surface.
+	auto getDisplacement = [&](const glm::ivec3 &point, float coarseValue) {
+		const float value = field[getIndex(point.x, point.y, point.z)].value;
+
+		if (value <= 0.0f || value >= 2.0f * threshold)
+			return 0.0f;
+
+		glm::vec3 gradient;
+
+		for (int32_t axis = 0; axis < 3; ++axis)
+		{
+			glm::ivec3 low = point, high = point;
+
+			low[axis] = std::max(low[axis] - 1, 0);
+			high[axis] = std::min(high[axis] + 1, fieldSize[axis] - 1);
+			gradient[axis] = field[getIndex(high.x, high.y, high.z)].value - field[getIndex(low.x, low.y, low.z)].value;
+			gradient[axis] /= float(high[axis] - low[axis]);
+		}
+
+		return std::abs(value - coarseValue) / std::max(glm::length(gradient), 1e-3f);
+	};
+
+	for (int32_t level = getMaxLevel(brick); level > 0; --level)
+	{
+		const int32_t stride = 1 << level;
+		float displacement = 0.0f;
+
+		for (int32_t z = first.z; z <= last.z && displacement <= options.lodTolerance; ++z)
+			for (int32_t y = first.y; y <= last.y; ++y)
+				for (int32_t x = first.x; x <= last.x; ++x)
+				{
+					const glm::ivec3 point(x, y, z), base = glm::min((point >> level) << level, last - stride);
+					const glm::vec3 factors = glm::vec3(point - base) / float(stride);
+					float value = 0.0f;
+
+					for (int32_t corner = 0; corner < 8; ++corner)
+					{
+						const glm::ivec3 offset(corner & 1, (corner >> 1) & 1, corner >> 2),
+							cornerPoint = base + offset * stride;
+						const float weight = (offset.x ? factors.x : 1.0f - factors.x) *
+											 (offset.y ? factors.y : 1.0f - factors.y) *
+											 (offset.z ? factors.z : 1.0f - factors.z);
+
+						value += weight * field[getIndex(cornerPoint.x, cornerPoint.y, cornerPoint.z)].value;
+					}
+
+					displacement = std::max(displacement, getDisplacement(point, value));
+				}
+
+		if (displacement <= options.lodTolerance)
+			return level;
+	}
+
+	return 0;
+}
+
+size_t Isosurface::getIndex(int32_t x, int32_t y, int32_t z) const
+{
+	return x + y * fieldSize.x + z * fieldSize.x * fieldSize.y;
+}
+
+glm::ivec3 Isosurface::getBrickCoord(uint32_t brick) const
+{
+	const int32_t square = bricksSize.x * bricksSize.y, a = int32_t(brick) % square;
+
+	return {a % bricksSize.x, a / bricksSize.x, int32_t(brick) / square};
+}
+
+uint32_t Isosurface::getBrickIndex(const glm::ivec3 &coord) const
+{
+	return uint32_t(coord.x + coord.y * bricksSize.x + coord.z * bricksSize.x * bricksSize.y);
+}
+
+Isosurface::MeshVertex Isosurface::getEdgeCrossing(const glm::ivec3 &point, int32_t axis) const
+{
+	glm::ivec3 next = point;
+
+	++next[axis];
+
+	const SpacePoint &sp1 = field[getIndex(point.x, point.y, point.z)], &sp2 = field[getIndex(next.x, next.y, next.z)];
+	const float factor = (threshold - sp1.value) / (sp2.value - sp1.value);
+	glm::vec3 position(point);
+
+	position[axis] += factor;
+
+	return {position, sp1.normal * (1.0f - factor) + sp2.normal * factor};
+}
+
+uint8_t Isosurface::getCubeConfig(int32_t x, int32_t y, int32_t z) const
+{
+	const size_t index = getIndex(x, y, z), row = fieldSize.x, slice = fieldSize.x * fieldSize.y;
+	const size_t corners[8] = {
+		index, index + 1, index + 1 + slice, index + slice,
+		index + row, index + 1 + row, index + 1 + row + slice, index + row + slice};
+	uint8_t config = 0x00;
+
+	for (int32_t i = 0; i < 8; ++i)
+		if (field[corners[i]].value > threshold)
+			config |= uint8_t(1 << i);
+
+	return config;
 }
 
 const int32_t Isosurface::edgesTable[256] = {
@@ -324,6 +1008,11 @@ const int32_t Isosurface::trianglesTable[256][16] = {
 	{0, 3, 8, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1},
 	{-1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1}};
 
+const glm::ivec3 Isosurface::cubeEdgeBases[12] = {{0, 0, 0}, {1, 0, 0}, {0, 0, 1}, {0, 0, 0}, {0, 1, 0}, {1, 1, 0},
+	{0, 1, 1}, {0, 1, 0}, {0, 0, 0}, {1, 0, 0}, {1, 0, 1}, {0, 0, 1}};
+
+const int32_t Isosurface::cubeEdgeAxes[12] = {0, 2, 0, 2, 0, 2, 0, 2, 1, 1, 1, 1};
+
 const float Isosurface::threshold = 0.65f;
 
 } // namespace b2
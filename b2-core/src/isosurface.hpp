@@ -1,15 +1,66 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cmath>
 #include <vector>
 
 #include <b2/logger.hpp>
 #include <glm/glm.hpp>
 
+#include "profiler.hpp"
 #include "threadpool.hpp"
 
+namespace b2::bench
+{
+struct IsosurfaceProbe;
+}
+
+namespace b2::tests
+{
+struct IsosurfaceProbe;
+}
+
 namespace b2
 {
 
+enum class NormalsMode
+{
+	// Gradient of the splatted field, sampled over the 27 neighbours of every point in a pass of its own.
+	Sampled,
+	// Gradient of every particle falloff, accumulated by the splat kernel along with the value.
+	Analytic
+};
+
+enum class ExtractionMode
+{
+	// A vertex on every crossed field edge and up to five triangles per cube, from the classic 256-case tables.
+	MarchingCubes,
+	// A vertex inside every crossed cube and a quad around every crossed edge: about half the vertices and fewer,
+	// better shaped triangles, at the price of a slightly smoother surface.
+	SurfaceNets
+};
+
+struct IsosurfaceOptions
+{
+	ExtractionMode extractionMode = ExtractionMode::MarchingCubes;
+	NormalsMode normalsMode = NormalsMode::Sampled;
+
+	// Incremental updates keep every particle where it was last splatted until it moves by more than moveThreshold
+	// field points, then re-splat and re-extract only the bricks around its old and new places. A settled fluid costs
+	// next to nothing, at the price of a surface lagging its particles by up to moveThreshold.
+	bool incremental = false;
+	float moveThreshold = 0.25f;
+
+	// Level of detail, for surface nets only: surface bricks farther than lodDistances.x, then lodDistances.y, field
+	// points from the view point are extracted from cells of 2, then 4 points a side. So are bricks where interpolating
+	// the values over the larger cells moves the surface by at most lodTolerance field points, as it is nearly flat.
+	// Polygons are built around the shortest crossed edges whatever the cells sizes, so levels join without cracks.
+	bool lod = false;
+	glm::vec2 lodDistances = glm::vec2(64.0f, 128.0f);
+	float lodTolerance = 0.0f;
+};
+
 class Isosurface
 {
 public:
@@ -18,174 +69,410 @@ public:
 		glm::vec3 position, normal;
 	};
 
+	// Vertices are shared by the triangles around them: each crossed field edge (marching cubes) or cube (surface
+	// nets) yields a single one.
+	struct Mesh
+	{
+		std::vector<MeshVertex> vertices;
+		std::vector<uint32_t> indices;
+	};
+
 	Isosurface() = default;
-	Isosurface(const glm::ivec3 &fieldSize, std::shared_ptr<ThreadPool> threadPool);
+	Isosurface(
+		const glm::ivec3 &fieldSize, std::shared_ptr<ThreadPool> threadPool, const IsosurfaceOptions &options = {});
 
-	template<typename Particle>
-	std::vector<MeshVertex> &generateMesh(
-		const std::vector<Particle> &particles, uint32_t radius, bool singleThread = true);
+	// Radius is the particle kernel half-width in field points; it sizes the splat stencil at compile time.
+	template<uint32_t Radius, typename Particle>
+	Mesh &generateMesh(const std::vector<Particle> &particles, bool singleThread = true);
+
+	[[nodiscard]] const Mesh &getMesh() const;
+
+	// View point in field coordinates, for the level of detail.
+	void setViewPoint(const glm::vec3 &point);
 
 private:
+	// Benchmarks run the stages of generateMesh() one at a time.
+	friend struct bench::IsosurfaceProbe;
+	// Tests compare the scalar field itself.
+	friend struct tests::IsosurfaceProbe;
+
 	struct SpacePoint
 	{
 		glm::vec3 normal;
 		float value;
 	};
 
-	template<typename Particle>
-	void generateScalarField(const std::vector<Particle> &particles, uint32_t radius, bool singleThread = true);
+	// Surface of one brick, kept until the values around it change: the vertices it owns with their keys, then the
+	// key of every triangle corner. Keys index edgeVertices: edge keys for marching cubes, cube indices for surface
+	// nets.
+	struct BrickGeometry
+	{
+		std::vector<MeshVertex> vertices;
+		std::vector<uint32_t> edges, corners;
+	};
+
+	// The field is tracked in bricks of brickSize^3 points. Only bricks reached by a particle kernel (active) hold
+	// non-zero values, and only bricks whose cubes straddle the threshold (surface) produce triangles, so every pass
+	// but the splat itself scales with the number of bricks near the surface rather than with the box volume. Passes
+	// after the splat only revisit the bricks around those whose values changed (dirty).
+	enum BrickFlags : uint8_t
+	{
+		ActiveBrick = 0x01,
+		DirtyBrick = 0x02,
+		// Within one brick of a dirty one, so its classification, normals and geometry may have changed.
+		AffectedBrick = 0x04,
+		SurfaceBrick = 0x08,
+		NormalsBrick = 0x10,
+		NormalsValidBrick = 0x20
+	};
+
+	// Clears and re-splats the whole field.
+	template<uint32_t Radius, typename Particle>
+	void generateScalarField(const std::vector<Particle> &particles, bool singleThread);
+	// Re-splats the bricks around the particles that moved beyond the threshold.
+	template<uint32_t Radius, typename Particle>
+	void updateScalarField(const std::vector<Particle> &particles, bool singleThread);
+	// Splats every particle at its splat position into the field, which must be zero where their kernels reach.
+	template<uint32_t Radius>
+	void splatBands(bool singleThread);
+	// Sets flags on every brick overlapped by the kernel of a particle, given in field coordinates.
+	template<uint32_t Radius>
+	void markBricks(const glm::vec3 &position, uint8_t flags);
+	// Adds the kernel of one particle, given in field coordinates, to the field points within Radius of it and
+	// inside [low, high).
+	template<uint32_t Radius>
+	void splatParticle(const glm::vec3 &position, bool analyticNormals, const glm::ivec3 &low, const glm::ivec3 &high);
+	// Stable counting sort of particle indices by particleBins: per-chunk histograms, a bin-major scan over them,
+	// then per-chunk scatters into binParticles, with the bin starts in binOffsets.
+	void sortParticles(size_t binsCount, bool singleThread);
+	// Starts a frame: keeps the flags that outlive it, turning those of active bricks into dirty ones if requested.
+	void resetBricks(bool dirtyActive);
+	// Zeroes the values and normals of the given bricks.
+	void zeroBricks(const std::vector<uint32_t> &bricks, bool singleThread);
+	// Lists active and dirty bricks, then flags and lists the bricks around dirty ones as affected.
+	void collectBricks();
+	// Reclassifies affected bricks from the value range of their cubes and rebuilds the surface list, then, for
+	// sampled normals, lists the bricks whose normals the surface vertices interpolate and are out of date.
+	void classifyBricks(bool singleThread);
 	void generateNormals(bool singleThread);
+	// Picks the level of every surface brick, then flags the bricks around those whose level changed as affected.
+	void selectLevels(bool singleThread);
+	// Rebuilds the geometry of affected surface bricks.
+	void extractSurface(bool singleThread);
+	// A vertex on every crossed edge the brick owns, then the triangles of each of its cubes.
+	void extractMarchingCubes(uint32_t brick, BrickGeometry &geometry) const;
+	// A vertex in every crossed cell of the brick, at the mean of its edge crossings, then a polygon joining the cells
+	// around every crossed edge it owns: the cell of the finest level and first quadrant around the edge owns it.
+	void extractSurfaceNets(uint32_t brick, BrickGeometry &geometry) const;
+	// Mean of the crossings on the unit edges over the faces of the cell based at base, if any.
+	[[nodiscard]] bool getCellVertex(const glm::ivec3 &base, int32_t stride, MeshVertex &vertex) const;
+	// Key and level of the cell of a surface brick holding point, if it lies within the field cubes.
+	[[nodiscard]] bool getCell(const glm::ivec3 &point, uint32_t &key, int32_t &level) const;
+	// Coarsest level whose cells tile the cubes of the brick.
+	[[nodiscard]] int32_t getMaxLevel(uint32_t brick) const;
+	// Coarsest level whose trilinear interpolation moves the surface of the brick by at most the tolerance.
+	[[nodiscard]] int32_t getFlatLevel(uint32_t brick) const;
+	// Gathers the geometry of every surface brick at prefix-summed offsets: vertices first, recording the vertex of
+	// every edge, then indices, so the output needs no locking and keeps a deterministic order.
+	void assembleMesh(bool singleThread);
+
+	template<typename Routine>
+	void runParallel(size_t count, size_t grain, bool singleThread, const Routine &routine);
+
+	[[nodiscard]] size_t getIndex(int32_t x, int32_t y, int32_t z) const;
+	[[nodiscard]] glm::ivec3 getBrickCoord(uint32_t brick) const;
+	[[nodiscard]] uint32_t getBrickIndex(const glm::ivec3 &coord) const;
+	[[nodiscard]] uint8_t getCubeConfig(int32_t x, int32_t y, int32_t z) const;
+	// Threshold crossing on the edge from point along axis, with the normals of its ends interpolated as they are.
+	[[nodiscard]] MeshVertex getEdgeCrossing(const glm::ivec3 &point, int32_t axis) const;
 
 	static const int32_t edgesTable[256];
 	static const int32_t trianglesTable[256][16];
+	// Base corner and axis of every cube edge, following the numbering of edgesTable and trianglesTable.
+	static const glm::ivec3 cubeEdgeBases[12];
+	static const int32_t cubeEdgeAxes[12];
 	static const float threshold;
+	static const size_t sortChunksCount = 64;
+	static const int32_t brickSize = 8;
+	static const int32_t maxLevel = 2;
+	static const uint8_t invalidLevel = 0xff;
 
-	std::vector<MeshVertex> mesh;
+	Mesh mesh;
 	std::vector<SpacePoint> field;
-	glm::ivec3 fieldSize;
+	std::vector<uint8_t> brickFlags;
+	// Level of every surface brick, level its values alone allow and level picked on this frame for every surface
+	// brick, in surfaceBricks order.
+	std::vector<uint8_t> brickLevels, flatLevels, surfaceLevels;
+	std::vector<BrickGeometry> brickGeometries;
+	std::vector<uint32_t> activeBricks, dirtyBricks, affectedBricks, surfaceBricks, normalsBricks;
+	// Vertex of every key: three edges (x, y, z) per field point for marching cubes, one cube per point for surface
+	// nets.
+	std::vector<uint32_t> edgeVertices;
+	// Particle binning: bin of every particle, particles sorted by bin, per-chunk scan and bin starts.
+	std::vector<uint32_t> particleBins, binParticles, binCounts, binOffsets;
+	// Where every particle was last splatted, in field coordinates.
+	std::vector<glm::vec3> splatPositions;
+	// First index and first vertex of every surface brick; the last entries are the totals.
+	std::vector<size_t> indexOffsets, vertexOffsets;
+	glm::ivec3 fieldSize, bricksSize;
+	glm::vec3 viewPoint = glm::vec3(0.0f);
+	bool viewMoved = false;
 	std::shared_ptr<ThreadPool> threadPool;
+	IsosurfaceOptions options;
 };
 
-template<typename Particle>
-std::vector<Isosurface::MeshVertex> &Isosurface::generateMesh(
-	const std::vector<Particle> &particles, uint32_t radius, bool singleThread)
+template<uint32_t Radius, typename Particle>
+Isosurface::Mesh &Isosurface::generateMesh(const std::vector<Particle> &particles, bool singleThread)
 {
-	auto getIndex = [this](const glm::ivec3 &s) -> int32_t {
-		return s.x + s.y * fieldSize.x + s.z * fieldSize.x * fieldSize.y;
-	};
-	auto lerp = [](const std::tuple<SpacePoint, glm::vec3> &s1,
-				   const std::tuple<SpacePoint, glm::vec3> &s2) -> std::tuple<glm::vec3, glm::vec3> {
-		auto [sp1, p1] = s1;
-		auto [sp2, p2] = s2;
-		float factor = (threshold - sp1.value) / (sp2.value - sp1.value);
+	ProfileZone zone("isosurface/mesh");
 
-		return std::make_tuple(p1 + (p2 - p1) * factor, sp1.normal * (1.0f - factor) + sp2.normal * factor);
-	};
+	if (options.incremental)
+		updateScalarField<Radius>(particles, singleThread);
+	else
+		generateScalarField<Radius>(particles, singleThread);
 
-	mesh.clear();
+	// Nothing changed, so neither did the surface.
+	if (dirtyBricks.empty() && !viewMoved)
+		return mesh;
 
-	generateScalarField(particles, radius, singleThread);
-	generateNormals(singleThread);
+	classifyBricks(singleThread);
 
-	for (int32_t z = 0; z < fieldSize.z - 1; ++z)
-		for (int32_t y = 0; y < fieldSize.y - 1; ++y)
-			for (int32_t x = 0; x < fieldSize.x - 1; ++x)
-			{
-				const std::tuple<SpacePoint, glm::vec3> scalars[] = {
-					{field[getIndex({x, y, z})], glm::vec3(x, y, z)},
-					{field[getIndex({x + 1, y, z})], glm::vec3(x + 1, y, z)},
-					{field[getIndex({x + 1, y, z + 1})], glm::vec3(x + 1, y, z + 1)},
-					{field[getIndex({x, y, z + 1})], glm::vec3(x, y, z + 1)},
-					{field[getIndex({x, y + 1, z})], glm::vec3(x, y + 1, z)},
-					{field[getIndex({x + 1, y + 1, z})], glm::vec3(x + 1, y + 1, z)},
-					{field[getIndex({x + 1, y + 1, z + 1})], glm::vec3(x + 1, y + 1, z + 1)},
-					{field[getIndex({x, y + 1, z + 1})], glm::vec3(x, y + 1, z + 1)}};
-				int32_t config = 0x00;
-
-				if (std::get<0>(scalars[0]).value > threshold)
-					config |= 0x01;
-				if (std::get<0>(scalars[1]).value > threshold)
-					config |= 0x02;
-				if (std::get<0>(scalars[2]).value > threshold)
-					config |= 0x04;
-				if (std::get<0>(scalars[3]).value > threshold)
-					config |= 0x08;
-				if (std::get<0>(scalars[4]).value > threshold)
-					config |= 0x10;
-				if (std::get<0>(scalars[5]).value > threshold)
-					config |= 0x20;
-				if (std::get<0>(scalars[6]).value > threshold)
-					config |= 0x40;
-				if (std::get<0>(scalars[7]).value > threshold)
-					config |= 0x80;
-
-				if (edgesTable[config] == 0x00)
-					continue;
-
-				std::tuple<glm::vec3, glm::vec3> vertices[12] = {};
-
-				if (edgesTable[config] & 0x01)
-					vertices[0] = lerp(scalars[0], scalars[1]);
-				if (edgesTable[config] & 0x02)
-					vertices[1] = lerp(scalars[1], scalars[2]);
-				if (edgesTable[config] & 0x04)
-					vertices[2] = lerp(scalars[2], scalars[3]);
-				if (edgesTable[config] & 0x08)
-					vertices[3] = lerp(scalars[3], scalars[0]);
-				if (edgesTable[config] & 0x10)
-					vertices[4] = lerp(scalars[4], scalars[5]);
-				if (edgesTable[config] & 0x20)
-					vertices[5] = lerp(scalars[5], scalars[6]);
-				if (edgesTable[config] & 0x40)
-					vertices[6] = lerp(scalars[6], scalars[7]);
-				if (edgesTable[config] & 0x80)
-					vertices[7] = lerp(scalars[7], scalars[4]);
-				if (edgesTable[config] & 0x0100)
-					vertices[8] = lerp(scalars[0], scalars[4]);
-				if (edgesTable[config] & 0x0200)
-					vertices[9] = lerp(scalars[1], scalars[5]);
-				if (edgesTable[config] & 0x0400)
-					vertices[10] = lerp(scalars[2], scalars[6]);
-				if (edgesTable[config] & 0x0800)
-					vertices[11] = lerp(scalars[3], scalars[7]);
-
-				for (int32_t i = 0; trianglesTable[config][i] != -1; i += 3)
-				{
-					auto [p1, n1] = vertices[trianglesTable[config][i]];
-					auto [p2, n2] = vertices[trianglesTable[config][i + 1]];
-					auto [p3, n3] = vertices[trianglesTable[config][i + 2]];
-
-					mesh.push_back({p1, n1});
-					mesh.push_back({p2, n2});
-					mesh.push_back({p3, n3});
-				}
-			}
+	if (options.lod)
+		selectLevels(singleThread);
+
+	viewMoved = false;
+
+	if (options.normalsMode == NormalsMode::Sampled)
+		generateNormals(singleThread);
+
+	extractSurface(singleThread);
+	assembleMesh(singleThread);
 
 	return mesh;
 }
 
-template<typename Particle>
-void Isosurface::generateScalarField(const std::vector<Particle> &particles, uint32_t radius, bool singleThread)
+template<uint32_t Radius, typename Particle>
+void Isosurface::generateScalarField(const std::vector<Particle> &particles, bool singleThread)
 {
-	std::fill(field.begin(), field.end(), SpacePoint({glm::vec3(0.0f), 0.0f}));
+	ProfileZone zone("isosurface/field");
+
+	const size_t particlesCount = particles.size();
+	const glm::vec3 offset(float(Radius + 1));
 
-	const size_t particlesCount = particles.size(), workersCount = threadPool->getWorkersCount(),
-				 batchSize = particlesCount / workersCount;
-	std::future<void> futures[workersCount];
-	auto routine = [this, radius](const std::vector<Particle> &particles, size_t offset, size_t count) {
-		const int32_t square = fieldSize.x * fieldSize.y;
+	splatPositions.resize(particlesCount);
+	zeroBricks(activeBricks, singleThread);
+	resetBricks(true);
 
-		for (size_t i = offset; i < offset + count; ++i)
+	runParallel(particlesCount, 4096, singleThread, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
 		{
-			const glm::vec3 position(particles[i].position + glm::vec3(radius + 1));
-			const glm::ivec3 coord(glm::roundEven(position));
+			splatPositions[i] = particles[i].position + offset;
+			markBricks<Radius>(splatPositions[i], ActiveBrick | DirtyBrick);
+		}
+	});
 
-			for (int32_t z = coord.z - radius; z <= coord.z + radius; ++z)
-				for (int32_t y = coord.y - radius; y <= coord.y + radius; ++y)
-					for (int32_t x = coord.x - radius; x <= coord.x + radius; ++x)
-					{
-						if (x < 0 || y < 0 || z < 0 || x >= fieldSize.x || y >= fieldSize.y || z >= fieldSize.z)
-							continue;
+	collectBricks();
+	splatBands<Radius>(singleThread);
+}
+
+template<uint32_t Radius, typename Particle>
+void Isosurface::updateScalarField(const std::vector<Particle> &particles, bool singleThread)
+{
+	static_assert(Radius < uint32_t(brickSize), "A particle kernel must fit the bricks around its own");
 
-						const int32_t index = x + y * fieldSize.x + z * square;
-						float distance = glm::length(glm::vec3(x, y, z) - position),
-							  factor = distance / (float(radius) * 1.5f);
+	ProfileZone zone("isosurface/field");
 
-						field[index].value += 1.0f - factor;
-					}
+	const bool reset = splatPositions.size() != particles.size();
+	const bool analyticNormals = options.normalsMode == NormalsMode::Analytic;
+	const float moveThreshold = options.moveThreshold * options.moveThreshold;
+	const size_t particlesCount = particles.size();
+	const glm::vec3 offset(float(Radius + 1));
+
+	splatPositions.resize(particlesCount);
+
+	// The first frame, or any change in the particles count, starts over from an empty field.
+	resetBricks(reset);
+
+	runParallel(particlesCount, 4096, singleThread, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const glm::vec3 position(particles[i].position + offset), shift = position - splatPositions[i];
+
+			if (reset || glm::dot(shift, shift) > moveThreshold)
+			{
+				if (!reset)
+					markBricks<Radius>(splatPositions[i], DirtyBrick);
+
+				splatPositions[i] = position;
+				markBricks<Radius>(position, DirtyBrick);
+			}
+
+			markBricks<Radius>(splatPositions[i], ActiveBrick);
 		}
-	};
+	});
 
-	if (singleThread)
-		routine(particles, 0, particlesCount);
-	else
+	collectBricks();
+
+	// Gathering a brick splats the kernel parts of the particles around it, which costs more per particle than the
+	// bands, so past half the active bricks the whole field is regenerated instead.
+	if (dirtyBricks.size() * 2 > activeBricks.size())
 	{
-		for (int32_t t = 0; t < workersCount; ++t)
-			futures[t] = threadPool->pushTask(routine, std::ref(particles), t * batchSize, batchSize);
+		for (uint32_t brick : activeBricks)
+			brickFlags[brick] |= DirtyBrick;
+
+		collectBricks();
+		zeroBricks(dirtyBricks, singleThread);
+		splatBands<Radius>(singleThread);
+
+		return;
+	}
+
+	// Particles are binned by the brick of their splat position. Every dirty brick is then re-splatted from the bins
+	// around it, clipped to itself, which needs no synchronization and keeps the accumulation order.
+	particleBins.resize(particlesCount);
+
+	runParallel(particlesCount, 4096, singleThread, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const glm::ivec3 coord(glm::roundEven(splatPositions[i]));
+
+			particleBins[i] = getBrickIndex(glm::clamp(coord, glm::ivec3(0), fieldSize - 1) / brickSize);
+		}
+	});
+
+	sortParticles(brickFlags.size(), singleThread);
+	zeroBricks(dirtyBricks, singleThread);
+
+	runParallel(dirtyBricks.size(), 1, singleThread, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const glm::ivec3 coord = getBrickCoord(dirtyBricks[i]), first = coord * brickSize,
+							 last = glm::min(first + brickSize, fieldSize), low = glm::max(coord - 1, 0),
+							 high = glm::min(coord + 1, bricksSize - 1);
+
+			for (int32_t z = low.z; z <= high.z; ++z)
+				for (int32_t y = low.y; y <= high.y; ++y)
+					for (int32_t x = low.x; x <= high.x; ++x)
+					{
+						const uint32_t bin = getBrickIndex({x, y, z});
+
+						for (uint32_t slot = binOffsets[bin]; slot < binOffsets[bin + 1]; ++slot)
+							splatParticle<Radius>(splatPositions[binParticles[slot]], analyticNormals, first, last);
+					}
+		}
+	});
+}
+
+template<uint32_t Radius>
+void Isosurface::splatBands(bool singleThread)
+{
+	// A particle only touches slices within Radius of its own, so particles are binned into z bands of
+	// 2 * Radius + 1 slices: two bands of the same parity never write to the same point and all even bands, then all
+	// odd bands, are splatted concurrently. Bands keep particle index order, so every point accumulates its
+	// contributions in the same order whatever the threads count.
+	const int32_t bandDepth = int32_t(2 * Radius + 1);
+	const bool analyticNormals = options.normalsMode == NormalsMode::Analytic;
+	const size_t particlesCount = splatPositions.size(), bandsCount = (fieldSize.z + bandDepth - 1) / bandDepth;
+
+	particleBins.resize(particlesCount);
+
+	runParallel(particlesCount, 4096, singleThread, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const int32_t z = glm::clamp(int32_t(glm::roundEven(splatPositions[i].z)), 0, fieldSize.z - 1);
+
+			particleBins[i] = uint32_t(z / bandDepth);
+		}
+	});
+
+	sortParticles(bandsCount, singleThread);
+
+	for (size_t parity = 0; parity < 2; ++parity)
+		runParallel((bandsCount + 1 - parity) / 2, 1, singleThread, [&](size_t begin, size_t end) {
+			for (size_t b = begin; b < end; ++b)
+			{
+				const size_t band = 2 * b + parity;
+
+				for (uint32_t slot = binOffsets[band]; slot < binOffsets[band + 1]; ++slot)
+					splatParticle<Radius>(
+						splatPositions[binParticles[slot]], analyticNormals, glm::ivec3(0), fieldSize);
+			}
+		});
+}
+
+template<uint32_t Radius>
+void Isosurface::markBricks(const glm::vec3 &position, uint8_t flags)
+{
+	const glm::ivec3 coord(glm::roundEven(position));
+	const glm::ivec3 low = glm::max(coord - int32_t(Radius), 0),
+					 high = glm::min(coord + int32_t(Radius), fieldSize - 1);
+
+	if (glm::any(glm::greaterThan(low, high)))
+		return;
 
-		for (auto &future : futures)
-			future.wait();
+	const glm::ivec3 firstBrick = low / brickSize, lastBrick = high / brickSize;
+
+	for (int32_t z = firstBrick.z; z <= lastBrick.z; ++z)
+		for (int32_t y = firstBrick.y; y <= lastBrick.y; ++y)
+			for (int32_t x = firstBrick.x; x <= lastBrick.x; ++x)
+				std::atomic_ref(brickFlags[getBrickIndex({x, y, z})]).fetch_or(flags, std::memory_order_relaxed);
+}
+
+template<uint32_t Radius>
+void Isosurface::splatParticle(
+	const glm::vec3 &position, bool analyticNormals, const glm::ivec3 &low, const glm::ivec3 &high)
+{
+	// Squared distances are separable, so the kernel is evaluated a row at a time from per-axis offsets. Rows are
+	// computed at their full compile-time width with no branches, which vectorizes, and only the additions into the
+	// field are clipped.
+	static constexpr int32_t width = int32_t(2 * Radius + 1);
+	static constexpr float falloff = 1.0f / (float(Radius) * 1.5f);
+	const glm::ivec3 first = glm::ivec3(glm::roundEven(position)) - int32_t(Radius);
+	// Clipped stencil range, relative to first.
+	const glm::ivec3 begin = glm::max(low - first, 0), end = glm::min(high - first, width);
+	float dx[width], dy[width], dz[width];
+
+	if (!glm::all(glm::lessThan(begin, end)))
+		return;
+
+	for (int32_t i = 0; i < width; ++i)
+	{
+		dx[i] = float(first.x + i) - position.x;
+		dy[i] = float(first.y + i) - position.y;
+		dz[i] = float(first.z + i) - position.z;
 	}
+
+	for (int32_t k = begin.z; k < end.z; ++k)
+		for (int32_t j = begin.y; j < end.y; ++j)
+		{
+			SpacePoint *row = field.data() + getIndex(first.x + begin.x, first.y + j, first.z + k);
+			float values[width], scales[width];
+
+			for (int32_t i = 0; i < width; ++i)
+			{
+				const float distance = std::sqrt(dx[i] * dx[i] + dy[j] * dy[j] + dz[k] * dz[k]);
+
+				values[i] = 1.0f - distance * falloff;
+				// The value falls off linearly with the distance, so it grows fastest towards the particle centre.
+				scales[i] = distance > 0.0f ? falloff / distance : 0.0f;
+			}
+
+			for (int32_t i = begin.x; i < end.x; ++i)
+				row[i - begin.x].value += values[i];
+
+			if (analyticNormals)
+				for (int32_t i = begin.x; i < end.x; ++i)
+					row[i - begin.x].normal -= glm::vec3(dx[i], dy[j], dz[k]) * scales[i];
+		}
+}
+
+template<typename Routine>
+void Isosurface::runParallel(size_t count, size_t grain, bool singleThread, const Routine &routine)
+{
+	if (singleThread)
+		routine(0, count);
+	else
+		threadPool->parallelFor(0, count, grain, std::ref(routine));
 }
 
 } // namespace b2
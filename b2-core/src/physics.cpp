@@ -1,9 +1,11 @@
+#include <algorithm>
+#include <numeric>
 #include <thread>
 
 #include <b2/logger.hpp>
-#include <glm/gtc/random.hpp>
 
 #include "physics.hpp"
+#include "profiler.hpp"
 #include "threadpool.hpp"
 
 #include "timer.hpp"
@@ -11,42 +13,149 @@
 namespace b2::physics
 {
 
+uint32_t getMortonCode(const glm::ivec3 &coord);
+
 Particle::Particle(const glm::vec3 &position) : position(position), delta(0.0f), active(true)
 {}
 
-ParticleCloud::Cell::Cell() : count(0), slots {}
+ParticleStorage::ParticleStorage(size_t count)
+	: x(count), y(count), z(count), dx(count), dy(count), dz(count), active(count)
 {}
 
-void ParticleCloud::Cell::reset()
+size_t ParticleStorage::size() const
+{
+	return active.size();
+}
+
+Particle ParticleStorage::get(size_t index) const
+{
+	Particle particle(getPosition(index));
+
+	particle.delta = getDelta(index);
+	particle.active = active[index] != 0;
+
+	return particle;
+}
+
+void ParticleStorage::set(size_t index, const Particle &particle)
+{
+	x[index] = particle.position.x;
+	y[index] = particle.position.y;
+	z[index] = particle.position.z;
+	dx[index] = particle.delta.x;
+	dy[index] = particle.delta.y;
+	dz[index] = particle.delta.z;
+	active[index] = particle.active ? 1 : 0;
+}
+
+glm::vec3 ParticleStorage::getPosition(size_t index) const
 {
-	count.store(0);
+	return {x[index], y[index], z[index]};
 }
 
-ParticleCloud::Grid::Grid(const glm::ivec3 &size) : size(size)
+glm::vec3 ParticleStorage::getDelta(size_t index) const
 {
-	const size_t linearSize = size.x * size.y * size.z;
+	return {dx[index], dy[index], dz[index]};
+}
+
+ParticleCloud::Grid::Grid(const glm::ivec3 &size, size_t particlesCount)
+	: cellStart(size.x * size.y * size.z),
+	  cellEnd(size.x * size.y * size.z),
+	  indices(particlesCount),
+	  particleCells(particlesCount),
+	  blockSums((cellStart.size() + scanBlockSize - 1) / scanBlockSize),
+	  size(size)
+{}
 
-	cells = std::vector<Cell>(linearSize);
+size_t ParticleCloud::Grid::getCellsCount() const
+{
+	return cellStart.size();
 }
 
 ParticleCloud::ParticleCloud(
-	const glm::ivec3 &gridSize, size_t particlesCount, Generator generator, std::shared_ptr<ThreadPool> threadPool)
-	: grid(gridSize), particles(particlesCount), generator(std::move(generator)), threadPool(std::move(threadPool))
+	const glm::ivec3 &gridSize, size_t particlesCount, Generator generator, std::shared_ptr<ThreadPool> threadPool,
+	const Options &options)
+	: grid(gridSize, particlesCount),
+	  particles(particlesCount),
+	  options(options),
+	  generator(std::move(generator)),
+	  collisionKernel(nullptr),
+	  threadPool(std::move(threadPool))
 {
+	const auto instructionSet = detectInstructionSet();
+
+	info(fmt::format("Collision kernel: {}", toString(instructionSet)));
+	collisionKernel = collision::getKernel(instructionSet);
+
 	for (size_t i = 0; i < particlesCount; ++i)
-		particles[i] = this->generator(i);
+		particles.set(i, this->generator(i));
+
+	if (options.reorderInterval > 0)
+	{
+		const int32_t width = gridSize.x, square = width * gridSize.y;
+		auto &mortonCells = grid.mortonCells;
+
+		mortonCells.resize(grid.getCellsCount());
+		std::iota(mortonCells.begin(), mortonCells.end(), 0);
+		std::sort(mortonCells.begin(), mortonCells.end(), [width, square](uint32_t a, uint32_t b) {
+			return getMortonCode({(a % square) % width, (a % square) / width, a / square}) <
+				   getMortonCode({(b % square) % width, (b % square) / width, b / square});
+		});
+
+		reordered = ParticleStorage(particlesCount);
+		permutation.resize(particlesCount);
+	}
 }
 
 void ParticleCloud::update(const glm::vec3 &acceleration, float dt, bool singleThread)
 {
+	ProfileZone zone("physics/step");
+
+	Timer phaseTimer;
+
 	moveParticles(acceleration, dt, singleThread);
+	timings.move += phaseTimer.getDeltaMs();
 
-	for (size_t i = 0; i < solverIterations; ++i)
+	for (size_t i = 0; i < options.solverIterations; ++i)
 	{
 		resolveBounds(singleThread);
+		timings.bounds += phaseTimer.getDeltaMs();
 		fill(singleThread);
-		resolve(singleThread);
+		timings.fill += phaseTimer.getDeltaMs();
+		resolve(singleThread, options.seed + uint32_t(resolvesCount++));
+		timings.resolve += phaseTimer.getDeltaMs();
+	}
+
+	++stepsCount;
+	++timings.stepsCount;
+
+	if (options.reorderInterval > 0 && stepsCount % options.reorderInterval == 0)
+	{
+		reorder(singleThread);
+		timings.reorder += phaseTimer.getDeltaMs();
 	}
+
+	packed = false;
+}
+
+void ParticleCloud::setSolverIterations(size_t iterations)
+{
+	options.solverIterations = std::max<size_t>(iterations, 1);
+}
+
+size_t ParticleCloud::getSolverIterations() const
+{
+	return options.solverIterations;
+}
+
+const Timings &ParticleCloud::getTimings() const
+{
+	return timings;
+}
+
+void ParticleCloud::resetTimings()
+{
+	timings = Timings();
 }
 
 glm::ivec3 ParticleCloud::getGridSize() const
@@ -54,205 +163,318 @@ glm::ivec3 ParticleCloud::getGridSize() const
 	return grid.size;
 }
 
-const std::vector<Particle> &ParticleCloud::getParticles() const
+const ParticleStorage &ParticleCloud::getStorage() const
 {
 	return particles;
 }
 
-void ParticleCloud::moveParticles(const glm::vec3 &acceleration, float dt, bool singleThread)
+const std::vector<Particle> &ParticleCloud::getParticles() const
 {
-	const size_t workersCount = threadPool->getWorkersCount(), particlesCount = particles.size(),
-				 batchSize = particlesCount / workersCount;
-	std::future<void> futures[workersCount];
-	auto routine = [](std::vector<Particle> &particles, const glm::vec3 acceleration, size_t offset, size_t count,
-					  float dt) {
-		for (size_t i = offset; i < offset + count; ++i)
-		{
-			Particle &particle = particles[i];
+	if (!packed)
+	{
+		const size_t particlesCount = particles.size();
 
-			particle.delta += acceleration * dt * dt;
-			particle.position += particle.delta;
-		}
-	};
+		packedParticles.resize(particlesCount);
 
-	if (singleThread)
-		routine(particles, acceleration, 0, particlesCount, dt);
-	else
-	{
-		for (size_t i = 0; i < workersCount; ++i)
-			futures[i] = threadPool->pushTask(routine, std::ref(particles), acceleration, i * batchSize, batchSize, dt);
+		for (size_t i = 0; i < particlesCount; ++i)
+			packedParticles[i] = particles.get(i);
 
-		for (auto &future : futures)
-			future.wait();
+		packed = true;
 	}
+
+	return packedParticles;
+}
+
+const std::vector<uint32_t> &ParticleCloud::getPermutation() const
+{
+	return permutation;
+}
+
+size_t ParticleCloud::getReorderCount() const
+{
+	return reorderCount;
+}
+
+void ParticleCloud::moveParticles(const glm::vec3 &acceleration, float dt, bool singleThread)
+{
+	ProfileZone zone("physics/move");
+
+	const glm::vec3 impulse = acceleration * dt * dt;
+	float *x = particles.x.data(), *y = particles.y.data(), *z = particles.z.data();
+	float *dx = particles.dx.data(), *dy = particles.dy.data(), *dz = particles.dz.data();
+
+	runParallel(particles.size(), particlesGrain, singleThread, [=](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			dx[i] += impulse.x;
+			dy[i] += impulse.y;
+			dz[i] += impulse.z;
+			x[i] += dx[i];
+			y[i] += dy[i];
+			z[i] += dz[i];
+		}
+	});
 }
 
 void ParticleCloud::fill(bool singleThread)
 {
-	for (auto &cell : grid.cells)
-		cell.reset();
+	ProfileZone zone("physics/fill");
 
-	const size_t workersCount = threadPool->getWorkersCount(), particlesCount = particles.size(),
-				 batchSize = particles.size() / workersCount;
-	std::future<void> futures[workersCount];
-	auto routine = [this](Grid &grid, std::vector<Particle> &particles, size_t offset, size_t count) {
-		const int32_t width = grid.size.x, square = width * grid.size.y;
+	const size_t particlesCount = particles.size(), cellsCount = grid.getCellsCount(),
+				 blocksCount = grid.blockSums.size();
+	const int32_t width = grid.size.x, square = width * grid.size.y;
+	uint32_t *cellStart = grid.cellStart.data(), *cellEnd = grid.cellEnd.data(), *indices = grid.indices.data(),
+			 *particleCells = grid.particleCells.data(), *blockSums = grid.blockSums.data();
 
-		for (size_t i = offset; i < offset + count; ++i)
+	runParallel(cellsCount, cellsGrain, singleThread, [cellEnd](size_t begin, size_t end) {
+		std::fill(cellEnd + begin, cellEnd + end, 0);
+	});
+
+	// Histogram: cellEnd temporarily holds the population of every cell.
+	runParallel(particlesCount, particlesGrain, singleThread, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
 		{
-			auto &particle = particles[i];
-			const glm::vec3 &position = particle.position;
-			const glm::ivec3 cellCoord(position);
+			const glm::ivec3 cellCoord(particles.getPosition(i));
 			const size_t cellIdx = cellCoord.x + cellCoord.y * width + cellCoord.z * square;
 
-			if (cellIdx >= grid.cells.size())
-				particle.active = false;
+			if (cellIdx >= cellsCount)
+				particles.active[i] = 0;
 
-			if (!particle.active)
+			if (!particles.active[i])
+			{
+				particleCells[i] = invalidCell;
 				continue;
+			}
+
+			particleCells[i] = uint32_t(cellIdx);
+			std::atomic_ref(cellEnd[cellIdx]).fetch_add(1, std::memory_order_relaxed);
+		}
+	});
 
-			Cell &cell = grid.cells[cellIdx];
-			const uint8_t cellFilling = cell.count++;
+	// Exclusive prefix sum: block totals, a short serial scan over them, then block-local scans.
+	runParallel(blocksCount, 1, singleThread, [&](size_t begin, size_t end) {
+		for (size_t b = begin; b < end; ++b)
+		{
+			const size_t last = std::min(cellsCount, (b + 1) * scanBlockSize);
+			uint32_t sum = 0;
 
-			if (cellFilling >= cellCapacity)
-				throw std::runtime_error("Cell capacity is exceeded.");
+			for (size_t c = b * scanBlockSize; c < last; ++c)
+				sum += cellEnd[c];
 
-			cell.slots[cellFilling] = i;
+			blockSums[b] = sum;
 		}
-	};
+	});
 
-	if (singleThread)
-		routine(grid, particles, 0, particlesCount);
-	else
+	for (size_t b = 0, sum = 0; b < blocksCount; ++b)
 	{
-		for (size_t i = 0; i < workersCount; ++i)
-			futures[i] = threadPool->pushTask(routine, std::ref(grid), std::ref(particles), i * batchSize, batchSize);
+		const uint32_t blockSum = blockSums[b];
 
-		for (auto &future : futures)
-			future.wait();
+		blockSums[b] = uint32_t(sum);
+		sum += blockSum;
 	}
-}
 
-void ParticleCloud::resolve(bool singleThread)
-{
-	const size_t cellsCount = grid.cells.size(), batchSize = 1024, tasksCount = (cellsCount / batchSize) + 1;
-	std::future<void> futures[tasksCount];
-	auto routine = [](ParticleCloud *self, Grid &grid, std::vector<Particle> &particles, size_t offset, size_t count) {
-		const int32_t width = grid.size.x, square = width * grid.size.y;
-
-		for (size_t ci1 = offset; ci1 < offset + count; ++ci1)
+	runParallel(blocksCount, 1, singleThread, [&](size_t begin, size_t end) {
+		for (size_t b = begin; b < end; ++b)
 		{
-			const Cell &cell1 = grid.cells[ci1];
-			const glm::ivec3 cellCoord((ci1 % square) % width, (ci1 % square) / width, ci1 / square);
+			const size_t last = std::min(cellsCount, (b + 1) * scanBlockSize);
+			uint32_t sum = blockSums[b];
 
-			for (int32_t si1 = 0; si1 < cell1.count; ++si1)
+			for (size_t c = b * scanBlockSize; c < last; ++c)
 			{
-				for (int32_t z = cellCoord.z - 1; z <= cellCoord.z + 1; ++z)
-				{
-					for (int32_t y = cellCoord.y; y <= cellCoord.y + 1; ++y)
-					{
-						for (int32_t x = cellCoord.x - 1; x <= cellCoord.x + 1; ++x)
-						{
-							if (x < 0 || y < 0 || z < 0 || x >= grid.size.x || y >= grid.size.y || z >= grid.size.z)
-								continue;
-
-							const size_t ci2 = x + y * width + z * square;
-							const Cell &cell2 = grid.cells[ci2];
-
-							for (int32_t si2 = 0; si2 < cell2.count; ++si2)
-							{
-								const size_t pi1 = cell1.slots[si1], pi2 = cell2.slots[si2];
-
-								if (pi1 == pi2)
-									continue;
-
-								self->resolveParticles(particles[pi1], particles[pi2]);
-							}
-						}
-					}
-				}
+				const uint32_t population = cellEnd[c];
+
+				cellStart[c] = cellEnd[c] = sum;
+				sum += population;
 			}
 		}
-	};
+	});
 
-	if (singleThread)
-		routine(this, grid, particles, 0, cellsCount);
-	else
-	{
-		for (int32_t t = 0; t < tasksCount; ++t)
+	// Scatter: cellEnd is used as the insertion cursor and ends up one past the last particle of the cell.
+	runParallel(particlesCount, particlesGrain, singleThread, [&](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
 		{
-			const size_t offset = t * batchSize;
+			const uint32_t cellIdx = particleCells[i];
+
+			if (cellIdx == invalidCell)
+				continue;
 
-			futures[t] = threadPool->pushTask(
-				routine, this, std::ref(grid), std::ref(particles), offset, std::min(batchSize, cellsCount - offset));
+			indices[std::atomic_ref(cellEnd[cellIdx]).fetch_add(1, std::memory_order_relaxed)] = uint32_t(i);
 		}
+	});
+
+	// Atomic insertion order depends on scheduling; the deterministic mode restores index order inside every cell.
+	if (options.deterministic)
+		runParallel(cellsCount, cellsGrain, singleThread, [&](size_t begin, size_t end) {
+			for (size_t c = begin; c < end; ++c)
+				if (cellEnd[c] - cellStart[c] > 1)
+					std::sort(indices + cellStart[c], indices + cellEnd[c]);
+		});
+}
+
+void ParticleCloud::resolve(bool singleThread, uint32_t seed)
+{
+	ProfileZone zone("physics/resolve");
 
-		for (auto &future : futures)
-			future.wait();
+	if (options.deterministic || options.resolveMode == ResolveMode::Colored)
+	{
+		resolveColored(singleThread, seed);
+		return;
 	}
+
+	runParallel(grid.getCellsCount(), cellsGrain, singleThread, [this, seed](size_t begin, size_t end) {
+		for (size_t cellIdx = begin; cellIdx < end; ++cellIdx)
+			resolveCell(cellIdx, seed);
+	});
 }
 
-void ParticleCloud::resolveParticles(Particle &p1, Particle &p2)
+void ParticleCloud::resolveColored(bool singleThread, uint32_t seed)
 {
-	glm::vec3 pv = p1.position - p2.position;
-	float distance = glm::length(pv), bounce = 0.5f;
+	// A cell writes to particles at most one cell away, so two blocks of colorBlockSize^3 cells whose block
+	// coordinates have the same parity on every axis never touch the same particle. Every color is one parallel
+	// phase and blocks are resolved sequentially inside a task.
+	const int32_t width = grid.size.x, square = width * grid.size.y;
+	const glm::ivec3 blocks = (grid.size + (colorBlockSize - 1)) / colorBlockSize;
 
-	if (distance < 1.0f)
+	for (int32_t color = 0; color < 8; ++color)
 	{
-		float depth = (1.0f - distance) * 0.5f;
+		const glm::ivec3 first(color & 1, (color >> 1) & 1, (color >> 2) & 1), counts = (blocks - first + 1) / 2;
 
-		if (distance == 0.0f)
-			pv = glm::sphericalRand(1.0f);
-		else
-			pv /= distance;
+		runParallel(counts.x * counts.y * counts.z, 1, singleThread, [&](size_t begin, size_t end) {
+			for (size_t b = begin; b < end; ++b)
+			{
+				const glm::ivec3 block =
+					first + 2 * glm::ivec3(b % counts.x, (b / counts.x) % counts.y, b / (counts.x * counts.y));
+				const glm::ivec3 low = block * colorBlockSize, high = glm::min(low + colorBlockSize, grid.size);
+
+				for (int32_t z = low.z; z < high.z; ++z)
+					for (int32_t y = low.y; y < high.y; ++y)
+						for (int32_t x = low.x; x < high.x; ++x)
+							resolveCell(x + y * width + z * square, seed);
+			}
+		});
+	}
+}
 
-		pushParticle(p1, pv * depth);
-		pushParticle(p2, pv * -depth);
+void ParticleCloud::resolveCell(size_t cellIdx, uint32_t seed)
+{
+	const int32_t width = grid.size.x, square = width * grid.size.y;
+	const glm::ivec3 cellCoord((cellIdx % square) % width, (cellIdx % square) / width, cellIdx / square);
 
-		float exchange = ((1.0f + bounce) * glm::dot(p1.delta - p2.delta, pv)) * 0.5f;
+	for (uint32_t si1 = grid.cellStart[cellIdx]; si1 < grid.cellEnd[cellIdx]; ++si1)
+	{
+		const size_t pi1 = grid.indices[si1];
 
-		if (exchange > 1.0f)
+		for (int32_t z = cellCoord.z - 1; z <= cellCoord.z + 1; ++z)
 		{
-			p1.delta += pv * exchange;
-			p2.delta -= pv * exchange;
+			for (int32_t y = cellCoord.y; y <= cellCoord.y + 1; ++y)
+			{
+				if (y < 0 || z < 0 || y >= grid.size.y || z >= grid.size.z)
+					continue;
+
+				// Cells of one row are adjacent in the sorted index array, so the three neighbors along x form a
+				// single contiguous batch.
+				const size_t row = y * width + z * square;
+				const uint32_t begin = grid.cellStart[row + std::max(cellCoord.x - 1, 0)],
+							   end = grid.cellEnd[row + std::min(cellCoord.x + 1, width - 1)];
+
+				collisionKernel(particles, pi1, grid.indices.data() + begin, end - begin, seed);
+			}
 		}
 	}
 }
 
+void ParticleCloud::reorder(bool singleThread)
+{
+	ProfileZone zone("physics/reorder");
+
+	// The grid of the last fill() is already a per-cell bucketing of the particles, so walking its cells in Morton
+	// order yields the sorted permutation. Inactive particles keep their relative order at the tail.
+	const size_t particlesCount = particles.size();
+	size_t next = 0;
+
+	for (const uint32_t cellIdx : grid.mortonCells)
+		for (uint32_t slot = grid.cellStart[cellIdx]; slot < grid.cellEnd[cellIdx]; ++slot)
+			permutation[next++] = grid.indices[slot];
+
+	for (size_t i = 0; i < particlesCount; ++i)
+		if (grid.particleCells[i] == invalidCell)
+			permutation[next++] = uint32_t(i);
+
+	runParallel(particlesCount, particlesGrain, singleThread, [this](size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
+		{
+			const uint32_t source = permutation[i];
+
+			reordered.x[i] = particles.x[source];
+			reordered.y[i] = particles.y[source];
+			reordered.z[i] = particles.z[source];
+			reordered.dx[i] = particles.dx[source];
+			reordered.dy[i] = particles.dy[source];
+			reordered.dz[i] = particles.dz[source];
+			reordered.active[i] = particles.active[source];
+		}
+	});
+
+	std::swap(particles, reordered);
+	++reorderCount;
+}
+
 void ParticleCloud::resolveBounds(bool singleThread)
 {
-	auto collidePlane = [this](Particle &particle, const glm::vec3 &o, const glm::vec3 &normal) {
-		const float distance = glm::dot(particle.position - o, normal);
+	ProfileZone zone("physics/bounds");
 
-		if (distance <= 0.5f)
+	// Box planes are axis aligned, so every axis is resolved independently over its own pair of arrays.
+	auto collideAxis = [](float *position, float *delta, float boxSize, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; ++i)
 		{
-			const float depth = 0.5f - distance;
+			const float lowDepth = 0.5f - position[i];
 
-			pushParticle(particle, normal * depth);
-			particle.delta += 0.5f * depth * normal;
+			if (lowDepth >= 0.0f)
+			{
+				position[i] += lowDepth;
+				delta[i] += 1.5f * lowDepth;
+			}
+
+			const float highDepth = 0.5f - (boxSize - position[i]);
+
+			if (highDepth >= 0.0f)
+			{
+				position[i] -= highDepth;
+				delta[i] -= 1.5f * highDepth;
+			}
 		}
 	};
 	const glm::vec3 boxSize(grid.size);
 
-	for (Particle &particle : particles)
-	{
-		const std::tuple<glm::vec3, glm::vec3> planes[] = {
-			{glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f)},
-			{glm::vec3(boxSize.x, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f)},
-			{glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f)},
-			{glm::vec3(0.0f, boxSize.y, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)},
-			{glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f)},
-			{glm::vec3(0.0f, 0.0f, boxSize.z), glm::vec3(0.0f, 0.0f, -1.0f)}};
-
-		for (const auto &[o, normal] : planes)
-			collidePlane(particle, o, normal);
-	}
+	runParallel(particles.size(), particlesGrain, singleThread, [&](size_t begin, size_t end) {
+		collideAxis(particles.x.data(), particles.dx.data(), boxSize.x, begin, end);
+		collideAxis(particles.y.data(), particles.dy.data(), boxSize.y, begin, end);
+		collideAxis(particles.z.data(), particles.dz.data(), boxSize.z, begin, end);
+	});
 }
 
-void ParticleCloud::pushParticle(Particle &p, const glm::vec3 &v)
+template<typename Routine>
+void ParticleCloud::runParallel(size_t count, size_t grain, bool singleThread, const Routine &routine)
 {
-	p.position += v;
-	p.delta += v;
-};
+	if (singleThread)
+		routine(0, count);
+	else
+		threadPool->parallelFor(0, count, grain, std::ref(routine));
+}
+
+uint32_t getMortonCode(const glm::ivec3 &coord)
+{
+	auto spread = [](uint32_t value) -> uint32_t {
+		value &= 0x000003ff;
+		value = (value | (value << 16)) & 0xff0000ff;
+		value = (value | (value << 8)) & 0x0300f00f;
+		value = (value | (value << 4)) & 0x030c30c3;
+		value = (value | (value << 2)) & 0x09249249;
+
+		return value;
+	};
+
+	return spread(coord.x) | (spread(coord.y) << 1) | (spread(coord.z) << 2);
+}
 
 } // namespace b2::physics
@@ -6,8 +6,15 @@
 
 #include <glm/glm.hpp>
 
+#include "aligned.hpp"
+#include "physics/collision.hpp"
 #include "threadpool.hpp"
 
+namespace b2::bench
+{
+struct PhysicsProbe;
+}
+
 namespace b2::physics
 {
 
@@ -20,6 +27,56 @@ struct Particle
 	bool active;
 };
 
+struct ParticleStorage
+{
+	ParticleStorage() = default;
+	explicit ParticleStorage(size_t count);
+
+	[[nodiscard]] size_t size() const;
+
+	[[nodiscard]] Particle get(size_t index) const;
+	void set(size_t index, const Particle &particle);
+
+	[[nodiscard]] glm::vec3 getPosition(size_t index) const;
+	[[nodiscard]] glm::vec3 getDelta(size_t index) const;
+
+	AlignedVector<float> x, y, z, dx, dy, dz;
+	AlignedVector<uint8_t> active;
+};
+
+enum class ResolveMode
+{
+	// Cells are split in fixed batches; batches may touch the same particles concurrently.
+	Batched,
+	// Cells are grouped in independent color sets resolved one parallel phase at a time.
+	Colored
+};
+
+struct Options
+{
+	ResolveMode resolveMode = ResolveMode::Colored;
+
+	// Makes update() bit-reproducible across runs and thread counts: cells list their particles in index order and
+	// the colored resolve is used regardless of resolveMode.
+	bool deterministic = false;
+	// Seeds the pair hash that separates coincident particles.
+	uint32_t seed = 0;
+
+	// Every reorderInterval steps the particle arrays are sorted along a Morton curve of their grid cells, so that
+	// particles close in space stay close in memory. Zero disables the pass.
+	size_t reorderInterval = 0;
+
+	// Collision passes per step; more make piles stiffer at a proportional cost.
+	size_t solverIterations = 2;
+};
+
+// Wall time spent in every phase of ParticleCloud::update(), in milliseconds, summed over stepsCount steps.
+struct Timings
+{
+	float move = 0.0f, bounds = 0.0f, fill = 0.0f, resolve = 0.0f, reorder = 0.0f;
+	size_t stepsCount = 0;
+};
+
 class ParticleCloud
 {
 public:
@@ -27,45 +84,70 @@ public:
 
 	ParticleCloud() = default;
 	ParticleCloud(
-		const glm::ivec3 &gridSize, size_t particlesCount, Generator generator, std::shared_ptr<ThreadPool> threadPool);
+		const glm::ivec3 &gridSize, size_t particlesCount, Generator generator, std::shared_ptr<ThreadPool> threadPool,
+		const Options &options = {});
 
 	void update(const glm::vec3 &acceleration, float dt, bool singleThread = true);
 
 	[[nodiscard]] glm::ivec3 getGridSize() const;
+	[[nodiscard]] const ParticleStorage &getStorage() const;
 	[[nodiscard]] const std::vector<Particle> &getParticles() const;
 
-private:
-	static const size_t solverIterations = 2, cellCapacity = 16;
+	// Maps every particle index to the index it had before the latest reordering; getReorderCount() changes whenever
+	// a new permutation is published.
+	[[nodiscard]] const std::vector<uint32_t> &getPermutation() const;
+	[[nodiscard]] size_t getReorderCount() const;
 
-	struct Cell
-	{
-		Cell();
+	void setSolverIterations(size_t iterations);
+	[[nodiscard]] size_t getSolverIterations() const;
 
-		void reset();
+	// Phase timings summed since construction or the latest resetTimings().
+	[[nodiscard]] const Timings &getTimings() const;
+	void resetTimings();
 
-		size_t slots[cellCapacity];
-		std::atomic_uint8_t count;
-	};
+private:
+	// Benchmarks run the passes of update() one at a time.
+	friend struct bench::PhysicsProbe;
+
+	static const size_t scanBlockSize = 4096, particlesGrain = 4096, cellsGrain = 1024;
+	static const int32_t colorBlockSize = 4;
+	static const uint32_t invalidCell = UINT32_MAX;
 
+	// Uniform grid rebuilt by counting sort every fill(): the particles of cell c are
+	// indices[cellStart[c] .. cellEnd[c]).
 	struct Grid
 	{
 		Grid() = default;
-		explicit Grid(const glm::ivec3 &size);
+		Grid(const glm::ivec3 &size, size_t particlesCount);
+
+		[[nodiscard]] size_t getCellsCount() const;
 
-		std::vector<Cell> cells;
+		AlignedVector<uint32_t> cellStart, cellEnd, indices, particleCells;
+		std::vector<uint32_t> blockSums, mortonCells;
 		glm::ivec3 size;
 	};
 
 	void moveParticles(const glm::vec3 &acceleration, float dt, bool singleThread);
 	void fill(bool singleThread);
-	void resolve(bool singleThread);
-	void resolveParticles(Particle &p1, Particle &p2);
+	void resolve(bool singleThread, uint32_t seed);
+	void resolveColored(bool singleThread, uint32_t seed);
+	void resolveCell(size_t cellIdx, uint32_t seed);
 	void resolveBounds(bool singleThread);
-	void pushParticle(Particle &p, const glm::vec3 &v);
+	void reorder(bool singleThread);
+	template<typename Routine>
+	void runParallel(size_t count, size_t grain, bool singleThread, const Routine &routine);
 
 	Grid grid;
-	std::vector<Particle> particles;
+	ParticleStorage particles, reordered;
+	mutable std::vector<Particle> packedParticles;
+	mutable bool packed = false;
+	std::vector<uint32_t> permutation;
+	// resolvesCount counts the resolve passes run so far and seeds the pair hash of the next one.
+	size_t stepsCount = 0, reorderCount = 0, resolvesCount = 0;
+	Timings timings;
+	Options options;
 	Generator generator;
+	collision::Kernel collisionKernel;
 	std::shared_ptr<ThreadPool> threadPool;
 };
 
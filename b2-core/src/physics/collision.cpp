@@ -0,0 +1,263 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+#include "../physics.hpp"
+#include "collision.hpp"
+
+#if defined(B2_SIMD_X86)
+#include <immintrin.h>
+#endif
+
+namespace b2::physics::collision
+{
+
+namespace
+{
+
+// Vector kernels only cull candidates, on squared distances with a little slack so that no contact is lost to rounding.
+// Every candidate left is resolved by resolvePair(), which makes the exact test.
+constexpr float cullDistance = 1.0001f;
+
+// Resolves the particle, whose current state is (position, delta), against `other`: the pair is pushed apart along
+// their axis, then exchanges momentum along it using the pushed deltas.
+void resolvePair(
+	ParticleStorage &particles, size_t index, size_t other, uint32_t seed, glm::vec3 &position, glm::vec3 &delta)
+{
+	glm::vec3 pv = position - particles.getPosition(other);
+	const float distance = std::sqrt(pv.x * pv.x + pv.y * pv.y + pv.z * pv.z);
+
+	if (!(distance < 1.0f))
+		return;
+
+	if (distance == 0.0f)
+		pv = getCoincidentDirection(index, other, seed);
+	else
+		pv /= distance;
+
+	const glm::vec3 push = pv * ((1.0f - distance) * 0.5f);
+
+	position += push;
+	delta += push;
+	particles.x[other] -= push.x;
+	particles.y[other] -= push.y;
+	particles.z[other] -= push.z;
+	particles.dx[other] -= push.x;
+	particles.dy[other] -= push.y;
+	particles.dz[other] -= push.z;
+
+	const glm::vec3 relative = delta - particles.getDelta(other);
+	const float exchange = ((1.0f + bounce) * (relative.x * pv.x + relative.y * pv.y + relative.z * pv.z)) * 0.5f;
+
+	if (exchange > 1.0f)
+	{
+		const glm::vec3 impulse = pv * exchange;
+
+		delta += impulse;
+		particles.dx[other] -= impulse.x;
+		particles.dy[other] -= impulse.y;
+		particles.dz[other] -= impulse.z;
+	}
+}
+
+template<size_t Lanes>
+struct Batch
+{
+	alignas(32) float x[Lanes], y[Lanes], z[Lanes];
+};
+
+// Gathers candidate positions into lanes and returns the mask of lanes holding one. Unused lanes and the particle
+// itself are left out of the mask.
+template<size_t Lanes>
+int gather(
+	const ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, Batch<Lanes> &batch)
+{
+	int valid = 0;
+
+	for (size_t l = 0; l < Lanes; ++l)
+	{
+		const size_t other = l < count ? candidates[l] : index;
+
+		batch.x[l] = particles.x[other];
+		batch.y[l] = particles.y[other];
+		batch.z[l] = particles.z[other];
+
+		if (other != index)
+			valid |= 1 << l;
+	}
+
+	return valid;
+}
+
+void store(ParticleStorage &particles, size_t index, const glm::vec3 &position, const glm::vec3 &delta)
+{
+	particles.x[index] = position.x;
+	particles.y[index] = position.y;
+	particles.z[index] = position.z;
+	particles.dx[index] = delta.x;
+	particles.dy[index] = delta.y;
+	particles.dz[index] = delta.z;
+}
+
+} // namespace
+
+glm::vec3 getCoincidentDirection(size_t index, size_t other, uint32_t seed)
+{
+	auto mix = [](uint32_t value) -> uint32_t {
+		value ^= value >> 16;
+		value *= 0x7feb352d;
+		value ^= value >> 15;
+		value *= 0x846ca68b;
+		value ^= value >> 16;
+
+		return value;
+	};
+	const uint32_t first = uint32_t(std::min(index, other)), second = uint32_t(std::max(index, other));
+	const uint32_t h1 = mix(first ^ mix(second ^ mix(seed))), h2 = mix(h1 ^ 0x9e3779b9);
+	const float z = 1.0f - 2.0f * float(h1 >> 8) * (1.0f / 16777216.0f),
+				angle = 6.28318530718f * float(h2 >> 8) * (1.0f / 16777216.0f), radius = std::sqrt(1.0f - z * z);
+	const glm::vec3 direction(radius * std::cos(angle), radius * std::sin(angle), z);
+
+	// Both orderings of a pair must push the particles apart along the same axis.
+	return index < other ? direction : -direction;
+}
+
+void resolveScalar(ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed)
+{
+	glm::vec3 position = particles.getPosition(index), delta = particles.getDelta(index);
+
+	for (size_t c = 0; c < count; ++c)
+		if (candidates[c] != index)
+			resolvePair(particles, index, candidates[c], seed, position, delta);
+
+	store(particles, index, position, delta);
+}
+
+#if defined(B2_SIMD_X86)
+
+namespace
+{
+
+// Both batch routines test at most their lane count of candidates against the particle state (position, delta) and
+// resolve the lanes in contact in candidate order. A contact moves the particle, so the lanes after it are tested
+// again from the new position.
+
+B2_TARGET("sse2")
+void resolveBatchSSE2(
+	ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed,
+	glm::vec3 &position, glm::vec3 &delta)
+{
+	Batch<4> batch;
+	int pending = gather(particles, index, candidates, count, batch);
+	const __m128 x = _mm_load_ps(batch.x), y = _mm_load_ps(batch.y), z = _mm_load_ps(batch.z),
+				 limit = _mm_set1_ps(cullDistance * cullDistance);
+
+	while (pending)
+	{
+		const __m128 vx = _mm_sub_ps(_mm_set1_ps(position.x), x), vy = _mm_sub_ps(_mm_set1_ps(position.y), y),
+					 vz = _mm_sub_ps(_mm_set1_ps(position.z), z);
+		const __m128 squared = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+		const int near = _mm_movemask_ps(_mm_cmplt_ps(squared, limit)) & pending;
+
+		if (!near)
+			break;
+
+		const int lane = std::countr_zero(unsigned(near));
+
+		resolvePair(particles, index, candidates[lane], seed, position, delta);
+		pending &= ~((2 << lane) - 1);
+	}
+}
+
+B2_TARGET("avx2")
+void resolveBatchAVX2(
+	ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed,
+	glm::vec3 &position, glm::vec3 &delta)
+{
+	Batch<8> batch;
+	int pending = gather(particles, index, candidates, count, batch);
+	const __m256 x = _mm256_load_ps(batch.x), y = _mm256_load_ps(batch.y), z = _mm256_load_ps(batch.z),
+				 limit = _mm256_set1_ps(cullDistance * cullDistance);
+
+	while (pending)
+	{
+		const __m256 vx = _mm256_sub_ps(_mm256_set1_ps(position.x), x),
+					 vy = _mm256_sub_ps(_mm256_set1_ps(position.y), y),
+					 vz = _mm256_sub_ps(_mm256_set1_ps(position.z), z);
+		const __m256 squared =
+			_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(vx, vx), _mm256_mul_ps(vy, vy)), _mm256_mul_ps(vz, vz));
+		const int near = _mm256_movemask_ps(_mm256_cmp_ps(squared, limit, _CMP_LT_OQ)) & pending;
+
+		if (!near)
+			break;
+
+		const int lane = std::countr_zero(unsigned(near));
+
+		resolvePair(particles, index, candidates[lane], seed, position, delta);
+		pending &= ~((2 << lane) - 1);
+	}
+}
+
+} // namespace
+
+void resolveSSE2(ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed)
+{
+	glm::vec3 position = particles.getPosition(index), delta = particles.getDelta(index);
+
+	for (size_t offset = 0; offset < count; offset += 4)
+		resolveBatchSSE2(
+			particles, index, candidates + offset, std::min<size_t>(4, count - offset), seed, position, delta);
+
+	store(particles, index, position, delta);
+}
+
+void resolveAVX2(ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed)
+{
+	glm::vec3 position = particles.getPosition(index), delta = particles.getDelta(index);
+
+	// Neighborhoods are sparse at rest density, so tails that fit in four lanes take the narrower batch.
+	for (size_t offset = 0; offset < count;)
+	{
+		const size_t remaining = count - offset;
+
+		if (remaining > 4)
+		{
+			resolveBatchAVX2(
+				particles, index, candidates + offset, std::min<size_t>(8, remaining), seed, position, delta);
+			offset += 8;
+		}
+		else
+		{
+			resolveBatchSSE2(particles, index, candidates + offset, remaining, seed, position, delta);
+			offset += 4;
+		}
+	}
+
+	store(particles, index, position, delta);
+}
+
+#else
+
+void resolveSSE2(ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed)
+{
+	resolveScalar(particles, index, candidates, count, seed);
+}
+
+void resolveAVX2(ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed)
+{
+	resolveScalar(particles, index, candidates, count, seed);
+}
+
+#endif
+
+Kernel getKernel(InstructionSet instructionSet)
+{
+	switch (instructionSet)
+	{
+		case InstructionSet::SSE2: return resolveSSE2;
+		case InstructionSet::AVX2: return resolveAVX2;
+		default: return resolveScalar;
+	}
+}
+
+} // namespace b2::physics::collision
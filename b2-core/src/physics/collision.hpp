@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#include <glm/glm.hpp>
+
+#include "../simd.hpp"
+
+namespace b2::physics
+{
+
+struct ParticleStorage;
+
+}
+
+namespace b2::physics::collision
+{
+
+// Resolves one particle against a batch of candidates (usually the content of one neighbor cell), pair by pair in
+// candidate order: every contact updates the particle before the next candidate is tested, as the original pairwise
+// routine did. The candidate equal to `index` is skipped.
+//
+// resolveScalar is that pairwise routine. Vector kernels test whole batches of candidates in SIMD lanes and hand the
+// lanes in contact to the same scalar pair resolution, retesting the lanes after a contact from the moved particle, so
+// on a given host they match resolveScalar exactly. Results across compilers/flags (e.g. FMA contraction) agree within
+// `tolerance` absolute per component for one call.
+//
+// Coincident particles are separated along getCoincidentDirection(), a hash of the pair and `seed`, so the outcome
+// never depends on a shared random generator.
+using Kernel =
+	void (*)(ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed);
+
+constexpr float bounce = 0.5f;
+constexpr float tolerance = 1e-5f;
+
+void resolveScalar(ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed);
+void resolveSSE2(ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed);
+void resolveAVX2(ParticleStorage &particles, size_t index, const uint32_t *candidates, size_t count, uint32_t seed);
+
+[[nodiscard]] glm::vec3 getCoincidentDirection(size_t index, size_t other, uint32_t seed);
+
+[[nodiscard]] Kernel getKernel(InstructionSet instructionSet);
+
+} // namespace b2::physics::collision
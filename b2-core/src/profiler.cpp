@@ -0,0 +1,148 @@
+#include <fstream>
+
+#include <b2/logger.hpp>
+#include <nlohmann/json.hpp>
+
+#include "profiler.hpp"
+
+namespace b2
+{
+
+thread_local Profiler::ThreadBuffer *Profiler::currentBuffer = nullptr;
+
+Profiler::Profiler() : enabled(false), epoch(std::chrono::steady_clock::now())
+{}
+
+void Profiler::setEnabled(bool enabled)
+{
+	this->enabled.store(enabled, std::memory_order_relaxed);
+}
+
+bool Profiler::isEnabled() const
+{
+	return enabled.load(std::memory_order_relaxed);
+}
+
+void Profiler::setThreadName(const std::string &name)
+{
+	ThreadBuffer &buffer = getThreadBuffer();
+	std::lock_guard guard(lock);
+
+	buffer.name = name;
+}
+
+void Profiler::clear()
+{
+	std::lock_guard guard(lock);
+
+	for (auto &buffer : buffers)
+		buffer->first = buffer->count.load(std::memory_order_acquire);
+}
+
+void Profiler::writeTrace(const std::filesystem::path &path) const
+{
+	std::ofstream stream(path, std::ios::out | std::ios::trunc);
+
+	if (!stream.is_open())
+		throw std::runtime_error(fmt::format("Unable to open file '{}'.", path.string()));
+
+	std::lock_guard guard(lock);
+	const char *separator = "";
+	size_t droppedCount = 0;
+
+	stream << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+
+	for (const auto &buffer : buffers)
+	{
+		const std::string name = buffer->name.empty() ? fmt::format("thread {}", buffer->id) : buffer->name;
+
+		stream << separator
+			   << fmt::format(
+					  "\n{{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":{},\"args\":{{\"name\":{}}}}}",
+					  buffer->id, nlohmann::json(name).dump());
+		separator = ",";
+
+		droppedCount += buffer->droppedCount.load(std::memory_order_relaxed);
+
+		// Zones published up to now; the owner may be appending more meanwhile.
+		const size_t count = buffer->count.load(std::memory_order_acquire);
+
+		for (size_t i = buffer->first; i < count; ++i)
+		{
+			const Zone &zone = buffer->chunks[i / chunkSize][i % chunkSize];
+
+			stream << fmt::format(
+				",\n{{\"name\":{},\"ph\":\"X\",\"pid\":1,\"tid\":{},\"ts\":{:.3f},\"dur\":{:.3f}}}",
+				nlohmann::json(zone.name).dump(), buffer->id, double(zone.begin) * 1e-3,
+				double(zone.end - zone.begin) * 1e-3);
+		}
+	}
+
+	stream << "\n]}\n";
+
+	if (droppedCount > 0)
+		warning(fmt::format("Profiler buffers were full, {} zones were dropped", droppedCount));
+}
+
+uint64_t Profiler::getTimestamp() const
+{
+	return uint64_t(
+		std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count());
+}
+
+void Profiler::record(const char *name, uint64_t begin, uint64_t end)
+{
+	ThreadBuffer &buffer = getThreadBuffer();
+	const size_t index = buffer.count.load(std::memory_order_relaxed);
+
+	if (index >= maxZonesCount)
+	{
+		buffer.droppedCount.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+
+	auto &chunk = buffer.chunks[index / chunkSize];
+
+	if (chunk == nullptr)
+		chunk = std::make_unique<Zone[]>(chunkSize);
+
+	chunk[index % chunkSize] = {name, begin, end};
+	buffer.count.store(index + 1, std::memory_order_release);
+}
+
+Profiler &Profiler::getInstance()
+{
+	static Profiler instance;
+
+	return instance;
+}
+
+Profiler::ThreadBuffer &Profiler::getThreadBuffer()
+{
+	if (currentBuffer == nullptr)
+	{
+		std::lock_guard guard(lock);
+		auto &buffer = buffers.emplace_back(std::make_unique<ThreadBuffer>());
+
+		buffer->id = uint32_t(buffers.size());
+		currentBuffer = buffer.get();
+	}
+
+	return *currentBuffer;
+}
+
+ProfileZone::ProfileZone(const char *name)
+	: name(name), begin(Profiler::getInstance().isEnabled() ? Profiler::getInstance().getTimestamp() : noTimestamp)
+{}
+
+ProfileZone::~ProfileZone()
+{
+	if (begin != noTimestamp)
+	{
+		Profiler &profiler = Profiler::getInstance();
+
+		profiler.record(name, begin, profiler.getTimestamp());
+	}
+}
+
+} // namespace b2
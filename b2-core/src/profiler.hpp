@@ -0,0 +1,96 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace b2
+{
+
+// Zone profiler. Every thread records its zones into a buffer only it writes, so recording takes no lock; zones
+// nest by time, so a trace shows them as a hierarchy per thread. Recording is off until enabled, and a zone costs a
+// relaxed load while it is.
+class Profiler
+{
+public:
+	Profiler(const Profiler &) = delete;
+	Profiler &operator=(const Profiler &) = delete;
+
+	void setEnabled(bool enabled);
+	[[nodiscard]] bool isEnabled() const;
+
+	// Names the calling thread in traces.
+	void setThreadName(const std::string &name);
+
+	// Leaves the zones recorded so far out of later traces. Their memory is not reclaimed: every thread records at
+	// most maxZonesCount zones over the profiler lifetime and drops any past that.
+	void clear();
+
+	// Writes the zones recorded since the latest clear() in the Chrome trace event format, which chrome://tracing and
+	// Perfetto open.
+	void writeTrace(const std::filesystem::path &path) const;
+
+	// Nanoseconds since the profiler was created.
+	[[nodiscard]] uint64_t getTimestamp() const;
+	// Name must outlive the profiler, as string literals do.
+	void record(const char *name, uint64_t begin, uint64_t end);
+
+	static Profiler &getInstance();
+
+	static const size_t chunkSize = 4096, maxChunksCount = 512, maxZonesCount = chunkSize * maxChunksCount;
+
+private:
+	struct Zone
+	{
+		const char *name;
+		uint64_t begin, end;
+	};
+
+	// Zones in chunks that never move once allocated. The owning thread fills a zone, then publishes it by bumping
+	// the count, so readers always see a complete prefix.
+	struct ThreadBuffer
+	{
+		std::unique_ptr<Zone[]> chunks[maxChunksCount];
+		std::atomic<size_t> count = 0, droppedCount = 0;
+		// Guarded by the profiler lock.
+		size_t first = 0;
+		std::string name;
+		uint32_t id = 0;
+	};
+
+	Profiler();
+
+	ThreadBuffer &getThreadBuffer();
+
+	static thread_local ThreadBuffer *currentBuffer;
+
+	std::atomic_bool enabled;
+	std::chrono::steady_clock::time_point epoch;
+	mutable std::mutex lock;
+	std::vector<std::unique_ptr<ThreadBuffer>> buffers;
+};
+
+// Records the time between its construction and its destruction as a zone, if the profiler was enabled at
+// construction. Name must outlive the profiler, as string literals do.
+class ProfileZone
+{
+public:
+	explicit ProfileZone(const char *name);
+	ProfileZone(const ProfileZone &) = delete;
+	~ProfileZone();
+
+	ProfileZone &operator=(const ProfileZone &) = delete;
+
+private:
+	static const uint64_t noTimestamp = UINT64_MAX;
+
+	const char *name;
+	uint64_t begin;
+};
+
+} // namespace b2
@@ -5,6 +5,40 @@ namespace b2::render
 
 size_t getTypeSize(VertexAttribute::Type type);
 
+gles3::GLhandle BasicMesh::createBuffer(GLenum target, const void *data, size_t bytes, Usage usage)
+{
+	using namespace gles3;
+
+	GLuint id = 0;
+
+	_i(glGenBuffers, 1, &id);
+
+	GLhandle buffer(id, [](GLuint id) { _i(glDeleteBuffers, 1, &id); });
+
+	_i(glBindBuffer, target, GLuint(buffer));
+	_i(glBufferData, target, bytes, data, GLenum(usage));
+	_i(glBindBuffer, target, 0);
+
+	return buffer;
+}
+
+void BasicMesh::updateBuffer(GLenum target, const gles3::GLhandle &buffer, size_t &size, Usage usage,
+	const void *data, size_t bytes, size_t offset)
+{
+	using namespace gles3;
+
+	_i(glBindBuffer, target, GLuint(buffer));
+
+	if (offset + bytes > size)
+	{
+		size = (offset + bytes) * 3 / 2;
+		_i(glBufferData, target, size, nullptr, GLenum(usage));
+	}
+
+	_i(glBufferSubData, target, offset, bytes, data);
+	_i(glBindBuffer, target, 0);
+}
+
 void BasicMesh::bind() const
 {
 	using namespace gles3;
@@ -25,6 +59,19 @@ void BasicMesh::bind() const
 	}
 }
 
+void IndexedMesh::bind() const
+{
+	BasicMesh::bind();
+
+	// The element array binding is part of the vertex array state, so it stays bound for the draw call.
+	gles3::_i(glBindBuffer, GL_ELEMENT_ARRAY_BUFFER, GLuint(indexBuffer));
+}
+
+size_t IndexedMesh::getIndicesCount() const
+{
+	return indicesCount;
+}
+
 size_t getTypeSize(VertexAttribute::Type type)
 {
 	switch (type)
@@ -43,39 +43,71 @@ public:
 
 	virtual void bind() const;
 
+protected:
+	static gles3::GLhandle createBuffer(GLenum target, const void *data, size_t bytes, Usage usage);
+	// Growing reallocates the store, dropping its previous content, with headroom for meshes of varying size.
+	static void updateBuffer(GLenum target, const gles3::GLhandle &buffer, size_t &size, Usage usage,
+		const void *data, size_t bytes, size_t offset);
+
+	Usage usage = StaticDraw;
+
 private:
 	gles3::GLhandle buffer;
 	std::vector<VertexAttribute> layout;
+	size_t size = 0;
 };
 
+// Vertices plus 32-bit triangle indices, drawn with glDrawElements.
 class IndexedMesh : public BasicMesh
-{};
-
-template<class VertexT>
-BasicMesh::BasicMesh(const std::vector<VertexT> &vertices, std::vector<VertexAttribute> layout, Usage usage)
-	: layout(std::move(layout))
 {
-	using namespace gles3;
+public:
+	IndexedMesh() = default;
+	template<class VertexT>
+	IndexedMesh(const std::vector<VertexT> &vertices, const std::vector<uint32_t> &indices,
+		std::vector<VertexAttribute> layout, Usage usage = StaticDraw);
 
-	GLuint id = 0;
+	template<class VertexT>
+	void update(const std::vector<VertexT> &vertices, const std::vector<uint32_t> &indices);
 
-	_i(glGenBuffers, 1, &id);
+	void bind() const override;
 
-	buffer = GLhandle(id, [](GLuint id) { _i(glDeleteBuffers, 1, &id); });
+	[[nodiscard]] size_t getIndicesCount() const;
 
-	_i(glBindBuffer, GL_ARRAY_BUFFER, GLuint(buffer));
-	_i(glBufferData, GL_ARRAY_BUFFER, vertices.size() * sizeof(VertexT), vertices.data(), GLenum(usage));
-	_i(glBindBuffer, GL_ARRAY_BUFFER, 0);
-}
+private:
+	gles3::GLhandle indexBuffer;
+	size_t indicesSize = 0, indicesCount = 0;
+};
+
+template<class VertexT>
+BasicMesh::BasicMesh(const std::vector<VertexT> &vertices, std::vector<VertexAttribute> layout, Usage usage)
+	: usage(usage),
+	  buffer(createBuffer(GL_ARRAY_BUFFER, vertices.data(), vertices.size() * sizeof(VertexT), usage)),
+	  layout(std::move(layout)),
+	  size(vertices.size() * sizeof(VertexT))
+{}
 
 template<class VertexT>
 void BasicMesh::update(const std::vector<VertexT> &vertices, size_t offset)
 {
-	using namespace gles3;
+	updateBuffer(GL_ARRAY_BUFFER, buffer, size, usage, vertices.data(), vertices.size() * sizeof(VertexT), offset);
+}
 
-	_i(glBindBuffer, GL_ARRAY_BUFFER, GLuint(buffer));
-	_i(glBufferSubData, GL_ARRAY_BUFFER, offset, vertices.size() * sizeof(VertexT), vertices.data());
-	_i(glBindBuffer, GL_ARRAY_BUFFER, 0);
+template<class VertexT>
+IndexedMesh::IndexedMesh(const std::vector<VertexT> &vertices, const std::vector<uint32_t> &indices,
+	std::vector<VertexAttribute> layout, Usage usage)
+	: BasicMesh(vertices, std::move(layout), usage),
+	  indexBuffer(createBuffer(GL_ELEMENT_ARRAY_BUFFER, indices.data(), indices.size() * sizeof(uint32_t), usage)),
+	  indicesSize(indices.size() * sizeof(uint32_t)),
+	  indicesCount(indices.size())
+{}
+
+template<class VertexT>
+void IndexedMesh::update(const std::vector<VertexT> &vertices, const std::vector<uint32_t> &indices)
+{
+	BasicMesh::update(vertices);
+	updateBuffer(GL_ELEMENT_ARRAY_BUFFER, indexBuffer, indicesSize, usage, indices.data(),
+		indices.size() * sizeof(uint32_t), 0);
+	indicesCount = indices.size();
 }
 
 } // namespace b2::render
@@ -0,0 +1,50 @@
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "simd.hpp"
+
+namespace b2
+{
+
+InstructionSet detectInstructionSet()
+{
+#if defined(B2_SIMD_X86)
+#if defined(__GNUC__) || defined(__clang__)
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2"))
+		return InstructionSet::AVX2;
+	if (__builtin_cpu_supports("sse2"))
+		return InstructionSet::SSE2;
+#elif defined(_MSC_VER)
+	int info[4] = {};
+
+	__cpuid(info, 1);
+
+	const bool osAvx = (info[2] & (1 << 27)) && (info[2] & (1 << 28)) && (_xgetbv(0) & 0x06) == 0x06;
+
+	__cpuidex(info, 7, 0);
+
+	if (osAvx && (info[1] & (1 << 5)))
+		return InstructionSet::AVX2;
+
+	return InstructionSet::SSE2;
+#endif
+#endif
+
+	return InstructionSet::Scalar;
+}
+
+std::string toString(InstructionSet instructionSet)
+{
+	switch (instructionSet)
+	{
+		case InstructionSet::Scalar: return {"scalar"};
+		case InstructionSet::SSE2: return {"sse2"};
+		case InstructionSet::AVX2: return {"avx2"};
+		default: return {};
+	}
+}
+
+} // namespace b2
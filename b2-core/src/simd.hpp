@@ -0,0 +1,29 @@
+#pragma once
+
+#include <string>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define B2_SIMD_X86
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define B2_TARGET(isa) __attribute__((target(isa)))
+#else
+#define B2_TARGET(isa)
+#endif
+
+namespace b2
+{
+
+enum class InstructionSet
+{
+	Scalar,
+	SSE2,
+	AVX2
+};
+
+[[nodiscard]] InstructionSet detectInstructionSet();
+
+std::string toString(InstructionSet instructionSet);
+
+} // namespace b2
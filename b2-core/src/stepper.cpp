@@ -0,0 +1,70 @@
+#include <algorithm>
+#include <cmath>
+
+#include "stepper.hpp"
+
+namespace b2
+{
+
+Stepper::Stepper(const StepperOptions &options) : options(options), accumulator(0.0f), droppedSteps(0)
+{}
+
+size_t Stepper::advance()
+{
+	accumulator += timer.getDeltaMs() * 1e-3f;
+
+	size_t stepsCount = size_t(accumulator / options.timeStep);
+
+	if (stepsCount > options.maxSteps)
+	{
+		droppedSteps += stepsCount - options.maxSteps;
+		stepsCount = options.maxSteps;
+		accumulator = std::fmod(accumulator, options.timeStep);
+	}
+	else
+		accumulator -= float(stepsCount) * options.timeStep;
+
+	// Rounding may leave a hair over a whole step.
+	accumulator = std::clamp(accumulator, 0.0f, options.timeStep);
+
+	return stepsCount;
+}
+
+size_t Stepper::getIterations(float stepsMs, size_t stepsCount, size_t iterations) const
+{
+	if (options.budgetMs <= 0.0f || stepsCount == 0)
+		return iterations;
+
+	if (stepsMs > options.budgetMs && iterations > options.minIterations)
+		return iterations - 1;
+
+	// Most of a step is spent in the solver iterations, so its cost is taken as proportional to their count. Some
+	// slack keeps the count from flipping between two values every frame.
+	if (stepsMs * float(iterations + 1) / float(iterations) < options.budgetMs * 0.9f &&
+		iterations < options.maxIterations)
+		return iterations + 1;
+
+	return std::clamp(iterations, options.minIterations, options.maxIterations);
+}
+
+float Stepper::getAlpha() const
+{
+	return std::min(accumulator / options.timeStep, 1.0f);
+}
+
+float Stepper::getTimeToStepMs() const
+{
+	return (options.timeStep - accumulator) * 1e3f;
+}
+
+float Stepper::getTimeStep() const
+{
+	return options.timeStep;
+}
+
+size_t Stepper::getDroppedSteps() const
+{
+	return droppedSteps;
+}
+
+} // namespace b2
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <cstddef>
+
+#include "timer.hpp"
+
+namespace b2
+{
+
+struct StepperOptions
+{
+	// Simulated time of one step, in seconds.
+	float timeStep = 0.01f;
+	// Steps run for one frame at most. Time beyond them is dropped, so a slow frame slows the simulation down instead
+	// of asking for ever more steps on the next one.
+	size_t maxSteps = 4;
+	// Time the steps of one frame aim for, in milliseconds; zero keeps the solver iterations fixed.
+	float budgetMs = 0.0f;
+	size_t minIterations = 1, maxIterations = 4;
+};
+
+// Fixed timestep scheduler: accumulates real time and turns it into whole simulation steps, leaving the remainder for
+// render to interpolate between the two latest states.
+class Stepper
+{
+public:
+	explicit Stepper(const StepperOptions &options = {});
+
+	// Adds the real time elapsed since the previous call and returns how many steps to run now.
+	size_t advance();
+
+	// Solver iterations for the next steps, from the cost of the latest ones and the iterations they ran with.
+	[[nodiscard]] size_t getIterations(float stepsMs, size_t stepsCount, size_t iterations) const;
+	// Progress of the real time from the latest step towards the next one, in [0, 1].
+	[[nodiscard]] float getAlpha() const;
+	// Real time left before the next step is due, in milliseconds.
+	[[nodiscard]] float getTimeToStepMs() const;
+	[[nodiscard]] float getTimeStep() const;
+	[[nodiscard]] size_t getDroppedSteps() const;
+
+private:
+	StepperOptions options;
+	Timer timer;
+	float accumulator;
+	size_t droppedSteps;
+};
+
+} // namespace b2
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstddef>
+#include <latch>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+namespace b2
+{
+
+class ThreadPool;
+
+// Type-erased callable stored inline, so queueing one never allocates. A task may be queued several times at once
+// (parallelFor pushes one per helper): run() only reads the callable and counts the latch down once per call.
+class Task
+{
+public:
+	static const size_t storageSize = 48;
+
+	template<typename Function>
+	explicit Task(Function function, std::latch *latch = nullptr);
+	Task(const Task &) = delete;
+	Task &operator=(const Task &) = delete;
+	~Task();
+
+	void run() const;
+
+private:
+	friend class ThreadPool;
+
+	alignas(std::max_align_t) std::byte storage[storageSize];
+	void (*invoke)(const void *);
+	void (*destroy)(void *);
+	std::latch *latch;
+	// Set for tasks allocated by ThreadPool::pushTask(); the pool deletes them once run.
+	bool detached;
+};
+
+template<typename Function>
+Task::Task(Function function, std::latch *latch)
+	: invoke([](const void *callable) { (*static_cast<const Function *>(callable))(); }),
+	  destroy([](void *callable) { static_cast<Function *>(callable)->~Function(); }),
+	  latch(latch),
+	  detached(false)
+{
+	static_assert(sizeof(Function) <= storageSize, "Task callable does not fit the inline storage");
+	static_assert(alignof(Function) <= alignof(std::max_align_t), "Task callable is overaligned");
+
+	new (storage) Function(std::move(function));
+}
+
+inline Task::~Task()
+{
+	destroy(storage);
+}
+
+inline void Task::run() const
+{
+	invoke(storage);
+
+	if (latch)
+		latch->count_down();
+}
+
+} // namespace b2
@@ -1,56 +1,363 @@
+#include <algorithm>
 #include <cassert>
+#include <chrono>
 
 #include <b2/logger.hpp>
 
+#include "profiler.hpp"
+#include "simd.hpp"
 #include "threadpool.hpp"
 
+#if defined(B2_SIMD_X86)
+#include <immintrin.h>
+#endif
+
 namespace b2
 {
 
-ThreadPool::ThreadPool(size_t workerCount) : workers(workerCount), alarm(false), alive(true)
+namespace
+{
+
+// Identifies the pool and deque of the current thread when it is a worker.
+thread_local const ThreadPool *currentPool = nullptr;
+thread_local size_t currentIndex = 0;
+thread_local uint32_t victimSeed = 0;
+
+void pause();
+int64_t getTimestamp();
+
+} // namespace
+
+ThreadPool::ThreadPool(size_t workerCount, const ThreadPoolOptions &options)
+	: workers(workerCount),
+	  epoch(0),
+	  sleepersCount(0),
+	  notifyTime(0),
+	  alive(true),
+	  options(options)
 {
 	info(fmt::format("Threads count: {}", workers.size()));
 
-	for (ThreadPtr &thread : workers)
-		thread = std::make_unique<std::thread>(workerRoutine, this);
+	for (WorkerPtr &worker : workers)
+		worker = std::make_unique<Worker>();
+
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i]->thread = std::thread(workerRoutine, this, i);
 }
 
 ThreadPool::~ThreadPool()
 {
 	assert(alive);
 
+	alive.store(false);
+	epoch.fetch_add(1);
+	epoch.notify_all();
+
+	for (WorkerPtr &worker : workers)
+		worker->thread.join();
+}
+
+ThreadPoolStats ThreadPool::getStats() const
+{
+	ThreadPoolStats stats;
+
+	for (const WorkerPtr &worker : workers)
 	{
-		std::lock_guard lock(aliveLock);
+		const Counters &counters = worker->counters;
 
-		alive = false;
-		alarm.test_and_set();
-		alarm.notify_all();
+		stats.tasksCount += counters.tasksCount.load(std::memory_order_relaxed);
+		stats.stealsCount += counters.stealsCount.load(std::memory_order_relaxed);
+		stats.parksCount += counters.parksCount.load(std::memory_order_relaxed);
+		stats.wakeupsCount += counters.wakeupsCount.load(std::memory_order_relaxed);
+		stats.idleTime += counters.idleTime.load(std::memory_order_relaxed);
+		stats.wakeLatency += counters.wakeLatency.load(std::memory_order_relaxed);
+		stats.maxWakeLatency = std::max(stats.maxWakeLatency, counters.maxWakeLatency.load(std::memory_order_relaxed));
 	}
 
-	for (ThreadPtr &thread : workers)
-		thread->join();
+	return stats;
 }
 
-void ThreadPool::workerRoutine(ThreadPool *self)
+void ThreadPool::resetStats()
 {
-	while (true)
+	for (WorkerPtr &worker : workers)
 	{
-		auto task = self->popTask();
+		Counters &counters = worker->counters;
 
-		if (task)
-			task();
-		else
+		for (auto *counter : {&counters.tasksCount, &counters.stealsCount, &counters.parksCount, &counters.wakeupsCount,
+							  &counters.idleTime, &counters.wakeLatency, &counters.maxWakeLatency})
+			counter->store(0, std::memory_order_relaxed);
+	}
+}
+
+void ThreadPool::pushTask(Task &task)
+{
+	submit(&task);
+}
+
+void ThreadPool::pushBackgroundTask(Task &task)
+{
+	assert(!workers.empty());
+
+	background.push(&task);
+	wakeWorker();
+}
+
+void ThreadPool::wait(std::latch &latch)
+{
+	// Queued tasks, ours or not, are run here while waiting, which also keeps nested waits from starving the pool.
+	// Once nothing is left to run, every task of the latch is already running somewhere.
+	while (!latch.try_wait())
+		if (!runPendingTask(false))
 		{
-			self->alarm.wait(false);
+			latch.wait();
+			return;
+		}
+}
+
+void ThreadPool::submit(Task *task)
+{
+	if (currentPool == this)
+		workers[currentIndex]->tasks.push(task);
+	else
+		injected.push(task);
+
+	wakeWorker();
+}
+
+void ThreadPool::wakeWorker()
+{
+	// Pairs with the fence after the sleepers increment in waitForTask(): either the worker sees the task on its last
+	// scan or this thread sees the sleeper and bumps the epoch it waits on.
+	std::atomic_thread_fence(std::memory_order_seq_cst);
 
-			std::lock_guard lock(self->aliveLock);
+	if (sleepersCount.load(std::memory_order_relaxed) > 0)
+	{
+		notifyTime.store(getTimestamp(), std::memory_order_relaxed);
+		epoch.fetch_add(1, std::memory_order_relaxed);
+		epoch.notify_one();
+	}
+}
+
+Task *ThreadPool::findTask(bool background)
+{
+	const bool isWorker = currentPool == this;
+
+	if (isWorker)
+		if (Task *task = workers[currentIndex]->tasks.pop())
+			return task;
+
+	if (Task *task = injected.pop())
+		return task;
+
+	if (workers.empty())
+		return nullptr;
+
+	if (victimSeed == 0)
+		victimSeed = uint32_t(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
 
-			if (!self->alive)
-				return;
+	// xorshift32 picks where the scan over victims starts, so thieves do not all hit the same deque.
+	victimSeed ^= victimSeed << 13;
+	victimSeed ^= victimSeed >> 17;
+	victimSeed ^= victimSeed << 5;
 
-			self->alarm.clear();
+	const size_t workersCount = workers.size(), first = victimSeed % workersCount;
+
+	for (size_t i = 0; i < workersCount; ++i)
+	{
+		const size_t victim = (first + i) % workersCount;
+
+		if (isWorker && victim == currentIndex)
+			continue;
+
+		if (Task *task = workers[victim]->tasks.steal())
+		{
+			if (isWorker)
+				workers[currentIndex]->counters.stealsCount.fetch_add(1, std::memory_order_relaxed);
+
+			return task;
 		}
 	}
+
+	return background ? this->background.pop() : nullptr;
 }
 
+bool ThreadPool::runPendingTask(bool background)
+{
+	Task *task = findTask(background);
+
+	if (!task)
+		return false;
+
+	runTask(task);
+
+	return true;
+}
+
+Task *ThreadPool::waitForTask(Worker &worker)
+{
+	Counters &counters = worker.counters;
+	const int64_t idleStart = getTimestamp();
+	Task *task = nullptr;
+
+	for (size_t i = 0; !task && i < options.spinCount; ++i)
+	{
+		pause();
+		task = findTask(true);
+	}
+
+	for (size_t i = 0; !task && i < options.yieldCount; ++i)
+	{
+		std::this_thread::yield();
+		task = findTask(true);
+	}
+
+	while (!task)
+	{
+		sleepersCount.fetch_add(1, std::memory_order_seq_cst);
+		// Pairs with the fence in wakeWorker(): the scan below uses relaxed loads, which the increment alone does not
+		// order after itself.
+		std::atomic_thread_fence(std::memory_order_seq_cst);
+
+		const uint32_t observed = epoch.load(std::memory_order_seq_cst);
+
+		task = findTask(true);
+
+		// Queued tasks are drained before the worker exits.
+		if (!task && !alive.load())
+		{
+			sleepersCount.fetch_sub(1, std::memory_order_relaxed);
+			break;
+		}
+
+		if (!task)
+		{
+			const int64_t parkTime = getTimestamp();
+
+			counters.parksCount.fetch_add(1, std::memory_order_relaxed);
+
+			{
+				ProfileZone zone("pool/park");
+
+				epoch.wait(observed, std::memory_order_seq_cst);
+			}
+
+			// Only wakeups requested after parking are measured; others are spurious or raced with the scan above.
+			const int64_t wakeTime = getTimestamp(), requestTime = notifyTime.load(std::memory_order_relaxed);
+
+			if (requestTime >= parkTime)
+			{
+				const uint64_t latency = uint64_t(wakeTime - requestTime);
+
+				counters.wakeupsCount.fetch_add(1, std::memory_order_relaxed);
+				counters.wakeLatency.fetch_add(latency, std::memory_order_relaxed);
+
+				if (latency > counters.maxWakeLatency.load(std::memory_order_relaxed))
+					counters.maxWakeLatency.store(latency, std::memory_order_relaxed);
+			}
+		}
+
+		sleepersCount.fetch_sub(1, std::memory_order_relaxed);
+	}
+
+	counters.idleTime.fetch_add(uint64_t(getTimestamp() - idleStart), std::memory_order_relaxed);
+
+	return task;
+}
+
+void ThreadPool::runTask(Task *task)
+{
+	// A caller-owned task may be destroyed as soon as run() releases its latch.
+	const bool detached = task->detached;
+
+	{
+		ProfileZone zone("pool/task");
+
+		task->run();
+	}
+
+	if (detached)
+		delete task;
+
+	if (currentPool == this)
+		workers[currentIndex]->counters.tasksCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+void ThreadPool::workerRoutine(ThreadPool *self, size_t index)
+{
+	Worker &worker = *self->workers[index];
+
+	currentPool = self;
+	currentIndex = index;
+
+	Profiler::getInstance().setThreadName(fmt::format("Pool worker {}", index));
+
+	while (true)
+	{
+		if (self->runPendingTask(true))
+			continue;
+
+		if (Task *task = self->waitForTask(worker))
+			self->runTask(task);
+		else
+			return;
+	}
+}
+
+void ThreadPool::InjectionQueue::push(Task *task)
+{
+	std::lock_guard guard(lock);
+
+	const size_t capacity = tasks.size(), size = count.load(std::memory_order_relaxed);
+
+	if (size == capacity)
+	{
+		std::rotate(tasks.begin(), tasks.begin() + head, tasks.end());
+		tasks.resize(capacity * 2);
+		head = 0;
+	}
+
+	tasks[(head + size) % tasks.size()] = task;
+	count.store(size + 1, std::memory_order_relaxed);
+}
+
+Task *ThreadPool::InjectionQueue::pop()
+{
+	if (count.load(std::memory_order_relaxed) == 0)
+		return nullptr;
+
+	std::lock_guard guard(lock);
+
+	const size_t size = count.load(std::memory_order_relaxed);
+
+	if (size == 0)
+		return nullptr;
+
+	Task *task = tasks[head];
+
+	head = (head + 1) % tasks.size();
+	count.store(size - 1, std::memory_order_relaxed);
+
+	return task;
+}
+
+namespace
+{
+
+void pause()
+{
+#if defined(B2_SIMD_X86)
+	_mm_pause();
+#elif defined(__aarch64__)
+	asm volatile("yield");
+#endif
+}
+
+int64_t getTimestamp()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+} // namespace
+
 } // namespace b2
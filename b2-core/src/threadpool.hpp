@@ -1,86 +1,227 @@
 #pragma once
 
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
 #include <functional>
 #include <future>
+#include <latch>
 #include <memory>
 #include <mutex>
-#include <queue>
 #include <thread>
 #include <vector>
 
+#include "task.hpp"
+#include "workqueue.hpp"
+
 namespace b2
 {
 
+struct ThreadPoolOptions
+{
+	// An idle worker polls for work spinCount times with a pause hint, then yieldCount times yielding its time slice,
+	// and only then parks in the kernel. Spinning covers the short gaps between the passes of one frame.
+	size_t spinCount = 2048, yieldCount = 16;
+};
+
+// Counters summed over all workers since construction or the last resetStats(). Times are in nanoseconds.
+struct ThreadPoolStats
+{
+	uint64_t tasksCount = 0, stealsCount = 0, parksCount = 0, wakeupsCount = 0;
+	uint64_t idleTime = 0, wakeLatency = 0, maxWakeLatency = 0;
+};
+
+// Work-stealing pool: every worker owns a Chase-Lev deque that it pushes to and pops from, idle workers steal from
+// randomly chosen victims, and tasks pushed from outside the pool go through a shared injection queue. Long-running
+// jobs get a background queue of their own that only idle workers take from.
 class ThreadPool
 {
 public:
-	explicit ThreadPool(size_t workerCount = std::thread::hardware_concurrency());
+	explicit ThreadPool(
+		size_t workerCount = std::thread::hardware_concurrency(), const ThreadPoolOptions &options = {});
 	ThreadPool(const ThreadPool &) = delete;
 	ThreadPool &operator=(const ThreadPool &) = delete;
 	~ThreadPool();
 
-	template<typename Task, typename... Arguments>
-	[[nodiscard]] inline auto pushTask(Task task, Arguments &&...arguments)
-		-> std::future<std::invoke_result_t<Task, Arguments...>>;
+	// Convenience path for one-off work: allocates the task and its promise.
+	template<typename Function, typename... Arguments>
+	[[nodiscard]] inline auto pushTask(Function function, Arguments &&...arguments)
+		-> std::future<std::invoke_result_t<Function, Arguments...>>;
 
-	[[nodiscard]] inline size_t getWorkersCount() const;
+	// Queues a caller-owned task without allocating. The task must outlive its run, which wait() on its latch
+	// guarantees.
+	void pushTask(Task &task);
 
-private:
-	using ThreadPtr = std::unique_ptr<std::thread>;
+	// Queues a caller-owned task that may run for a long time, such as a loop over whole simulation steps. Only a
+	// worker with nothing else to do picks it up, never a thread helping in wait(), so the job cannot end up nested
+	// inside an unrelated wait. Needs at least one worker.
+	void pushBackgroundTask(Task &task);
+
+	// Runs queued tasks on the calling thread until the latch is released.
+	void wait(std::latch &latch);
 
-	[[nodiscard]] inline std::function<void()> popTask();
+	// Calls function(chunkBegin, chunkEnd) over [begin, end) in chunks of `grain` indices; zero grain picks one from
+	// the workers count. Workers and the calling thread claim chunks from a shared cursor until the range is exhausted
+	// and the call returns once every chunk is done.
+	template<typename Function>
+	void parallelFor(size_t begin, size_t end, size_t grain, Function function);
 
-	static void workerRoutine(ThreadPool *self);
+	// Folds the function(chunkBegin, chunkEnd) results of every chunk with combine(). Partial results are combined in
+	// chunk order, so the outcome does not depend on scheduling.
+	template<typename Result, typename Function, typename Combine>
+	[[nodiscard]] Result parallelReduce(
+		size_t begin, size_t end, size_t grain, Result identity, Function function, Combine combine);
+
+	[[nodiscard]] inline size_t getWorkersCount() const;
 
-	std::vector<ThreadPtr> workers;
-	std::queue<std::function<void()>> tasks;
-	std::mutex tasksLock, aliveLock;
-	std::atomic_flag alarm;
-	bool alive;
+	// Counters are updated with relaxed atomics, so a snapshot taken while workers run may be slightly torn.
+	[[nodiscard]] ThreadPoolStats getStats() const;
+	void resetStats();
+
+private:
+	// Written by the owning worker only.
+	struct Counters
+	{
+		std::atomic<uint64_t> tasksCount, stealsCount, parksCount, wakeupsCount, idleTime, wakeLatency, maxWakeLatency;
+	};
+
+	struct Worker
+	{
+		WorkStealingQueue<Task> tasks;
+		alignas(cacheLineSize) Counters counters;
+		std::thread thread;
+	};
+
+	using WorkerPtr = std::unique_ptr<Worker>;
+
+	// Ring buffer behind a mutex, grown when full and never shrunk.
+	struct InjectionQueue
+	{
+		std::vector<Task *> tasks = std::vector<Task *>(256);
+		size_t head = 0;
+		std::mutex lock;
+		alignas(cacheLineSize) std::atomic<size_t> count = 0;
+
+		void push(Task *task);
+		[[nodiscard]] Task *pop();
+	};
+
+	[[nodiscard]] inline size_t getGrain(size_t count, size_t grain) const;
+
+	// Queues on the calling worker's deque, or on the injection queue from any other thread, and wakes a sleeper.
+	void submit(Task *task);
+	void wakeWorker();
+	// Background tasks are only looked at when nothing else is queued.
+	[[nodiscard]] Task *findTask(bool background);
+	// Spins, yields and finally parks until a task is found; returns nullptr once the pool is shutting down.
+	[[nodiscard]] Task *waitForTask(Worker &worker);
+	// Runs one queued task if any is available; lets waiting threads help instead of blocking.
+	bool runPendingTask(bool background);
+
+	void runTask(Task *task);
+	static void workerRoutine(ThreadPool *self, size_t index);
+
+	std::vector<WorkerPtr> workers;
+	InjectionQueue injected, background;
+	alignas(cacheLineSize) std::atomic<uint32_t> epoch;
+	std::atomic<size_t> sleepersCount;
+	// Time of the latest wakeup request, for the wake latency counters.
+	std::atomic<int64_t> notifyTime;
+	std::atomic<bool> alive;
+	ThreadPoolOptions options;
 };
 
-template<typename Task, typename... Arguments>
-auto ThreadPool::pushTask(Task task, Arguments &&...arguments) -> std::future<std::invoke_result_t<Task, Arguments...>>
+template<typename Function, typename... Arguments>
+auto ThreadPool::pushTask(Function function, Arguments &&...arguments)
+	-> std::future<std::invoke_result_t<Function, Arguments...>>
 {
-	using TaskResult = std::invoke_result_t<Task, Arguments...>;
+	using TaskResult = std::invoke_result_t<Function, Arguments...>;
 
 	auto promise = std::make_shared<std::promise<TaskResult>>();
 	auto future = promise->get_future();
-
-	std::lock_guard lock(tasksLock);
-
-	tasks.push([promise, task, arguments...]() {
+	auto work = std::make_shared<std::function<void()>>([promise, function, arguments...]() {
 		if constexpr (std::is_void_v<TaskResult>)
 		{
-			task(arguments...);
+			function(arguments...);
 			promise->set_value();
 		}
 		else
-			promise->set_value(task(arguments...));
+			promise->set_value(function(arguments...));
 	});
-	alarm.test_and_set();
-	alarm.notify_one();
+	Task *task = new Task([work]() { (*work)(); });
+
+	task->detached = true;
+	submit(task);
 
 	return future;
 }
 
-size_t ThreadPool::getWorkersCount() const
+template<typename Function>
+void ThreadPool::parallelFor(size_t begin, size_t end, size_t grain, Function function)
 {
-	return workers.size();
+	if (begin >= end)
+		return;
+
+	grain = getGrain(end - begin, grain);
+
+	const size_t chunksCount = (end - begin + grain - 1) / grain;
+	const size_t helpersCount = std::min(workers.size(), chunksCount - 1);
+
+	if (helpersCount == 0)
+	{
+		function(begin, end);
+		return;
+	}
+
+	// The whole loop lives on this stack frame: one task is queued once per helper and the latch keeps the frame
+	// alive until every helper has returned.
+	std::atomic<size_t> next(begin);
+	std::latch latch(std::ptrdiff_t(helpersCount + 1));
+	auto routine = [&next, &function, end, grain]() {
+		for (size_t chunk = next.fetch_add(grain, std::memory_order_relaxed); chunk < end;
+			 chunk = next.fetch_add(grain, std::memory_order_relaxed))
+			function(chunk, std::min(chunk + grain, end));
+	};
+	Task helper(routine, &latch);
+
+	for (size_t i = 0; i < helpersCount; ++i)
+		submit(&helper);
+
+	helper.run();
+	wait(latch);
 }
 
-std::function<void()> ThreadPool::popTask()
+template<typename Result, typename Function, typename Combine>
+Result ThreadPool::parallelReduce(
+	size_t begin, size_t end, size_t grain, Result identity, Function function, Combine combine)
 {
-	std::lock_guard lock(tasksLock);
+	if (begin >= end)
+		return identity;
+
+	grain = getGrain(end - begin, grain);
+
+	std::vector<Result> partials((end - begin + grain - 1) / grain, identity);
+
+	parallelFor(0, partials.size(), 1, [&](size_t first, size_t last) {
+		for (size_t chunk = first; chunk < last; ++chunk)
+			partials[chunk] = function(begin + chunk * grain, std::min(begin + (chunk + 1) * grain, end));
+	});
 
-	if (tasks.empty())
-		return {};
+	for (const Result &partial : partials)
+		identity = combine(identity, partial);
 
-	auto task = std::move(tasks.front());
+	return identity;
+}
 
-	tasks.pop();
+size_t ThreadPool::getWorkersCount() const
+{
+	return workers.size();
+}
 
-	return task;
+size_t ThreadPool::getGrain(size_t count, size_t grain) const
+{
+	// A few chunks per participant leave room for load balancing without making the cursor contended.
+	return grain > 0 ? grain : std::max<size_t>(1, count / (4 * (workers.size() + 1)));
 }
 
 } // namespace b2
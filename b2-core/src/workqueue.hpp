@@ -0,0 +1,159 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "aligned.hpp"
+
+namespace b2
+{
+
+// Chase-Lev deque (Lê et al., "Correct and Efficient Work-Stealing for Weak Memory Models"). The owner thread pushes
+// and pops at the bottom, any other thread steals from the top. Items are not owned by the queue.
+template<typename T>
+class WorkStealingQueue
+{
+public:
+	explicit WorkStealingQueue(size_t capacity = 256);
+	WorkStealingQueue(const WorkStealingQueue &) = delete;
+	WorkStealingQueue &operator=(const WorkStealingQueue &) = delete;
+
+	// Owner only.
+	void push(T *item);
+	[[nodiscard]] T *pop();
+
+	// Any thread; returns nullptr when the queue is empty or another thief won the race.
+	[[nodiscard]] T *steal();
+
+private:
+	struct Buffer
+	{
+		explicit Buffer(size_t capacity);
+
+		[[nodiscard]] T *get(int64_t index) const;
+		void put(int64_t index, T *item);
+
+		std::vector<std::atomic<T *>> items;
+		int64_t mask;
+	};
+
+	[[nodiscard]] Buffer *grow(Buffer *buffer, int64_t bottom, int64_t top);
+
+	alignas(cacheLineSize) std::atomic<int64_t> top;
+	alignas(cacheLineSize) std::atomic<int64_t> bottom;
+	alignas(cacheLineSize) std::atomic<Buffer *> buffer;
+	// Thieves may still read a buffer after it was replaced, so every buffer lives as long as the queue.
+	std::vector<std::unique_ptr<Buffer>> buffers;
+};
+
+template<typename T>
+WorkStealingQueue<T>::Buffer::Buffer(size_t capacity) : items(capacity), mask(int64_t(capacity) - 1)
+{}
+
+template<typename T>
+T *WorkStealingQueue<T>::Buffer::get(int64_t index) const
+{
+	return items[index & mask].load(std::memory_order_relaxed);
+}
+
+template<typename T>
+void WorkStealingQueue<T>::Buffer::put(int64_t index, T *item)
+{
+	items[index & mask].store(item, std::memory_order_relaxed);
+}
+
+template<typename T>
+WorkStealingQueue<T>::WorkStealingQueue(size_t capacity) : top(0), bottom(0), buffer(nullptr)
+{
+	// Capacity must be a power of two for the index mask.
+	size_t powerOfTwo = 1;
+
+	while (powerOfTwo < capacity)
+		powerOfTwo <<= 1;
+
+	buffers.push_back(std::make_unique<Buffer>(powerOfTwo));
+	buffer.store(buffers.back().get(), std::memory_order_relaxed);
+}
+
+template<typename T>
+void WorkStealingQueue<T>::push(T *item)
+{
+	const int64_t b = bottom.load(std::memory_order_relaxed), t = top.load(std::memory_order_acquire);
+	Buffer *current = buffer.load(std::memory_order_relaxed);
+
+	if (b - t > current->mask)
+		current = grow(current, b, t);
+
+	current->put(b, item);
+	bottom.store(b + 1, std::memory_order_release);
+}
+
+template<typename T>
+T *WorkStealingQueue<T>::pop()
+{
+	const int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+	Buffer *current = buffer.load(std::memory_order_relaxed);
+
+	bottom.store(b, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	int64_t t = top.load(std::memory_order_relaxed);
+
+	if (t > b)
+	{
+		bottom.store(b + 1, std::memory_order_relaxed);
+		return nullptr;
+	}
+
+	T *item = current->get(b);
+
+	if (t == b)
+	{
+		// Last item: race the thieves for it.
+		if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+			item = nullptr;
+
+		bottom.store(b + 1, std::memory_order_relaxed);
+	}
+
+	return item;
+}
+
+template<typename T>
+T *WorkStealingQueue<T>::steal()
+{
+	int64_t t = top.load(std::memory_order_acquire);
+
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+
+	const int64_t b = bottom.load(std::memory_order_acquire);
+
+	if (t >= b)
+		return nullptr;
+
+	T *item = buffer.load(std::memory_order_acquire)->get(t);
+
+	if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+		return nullptr;
+
+	return item;
+}
+
+template<typename T>
+typename WorkStealingQueue<T>::Buffer *WorkStealingQueue<T>::grow(Buffer *current, int64_t b, int64_t t)
+{
+	buffers.push_back(std::make_unique<Buffer>(current->items.size() * 2));
+
+	Buffer *grown = buffers.back().get();
+
+	for (int64_t i = t; i < b; ++i)
+		grown->put(i, current->get(i));
+
+	buffer.store(grown, std::memory_order_release);
+
+	return grown;
+}
+
+} // namespace b2
@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+
+#include <b2/logger.hpp>
+#include <nlohmann/json.hpp>
+
+#include "config.hpp"
+#include "profiler.hpp"
+#include "simulation.hpp"
+#include "utils.hpp"
+
+// Usage: b2-sim [config path] [--steps count] [--threads count] [--trace path]
+// The config defaults to configs/game.json, as with b2-app run from the assets directory. One thread runs the steps
+// without the pool. --trace records the whole run and writes it as a Chrome trace.
+int main(int argc, const char **argv)
+{
+	using namespace b2;
+	using json = nlohmann::json;
+
+	auto loggerAnchor = Logger::getInstance().setWriteCallback([](const std::string &s) { std::cout << s; });
+
+	try
+	{
+		std::string configPath = "configs/game.json", tracePath;
+		size_t stepsCount = 0, threadsCount = 0;
+
+		for (int i = 1; i < argc; ++i)
+		{
+			if (std::strcmp(argv[i], "--steps") == 0 && i + 1 < argc)
+				stepsCount = std::stoul(argv[++i]);
+			else if (std::strcmp(argv[i], "--threads") == 0 && i + 1 < argc)
+				threadsCount = std::stoul(argv[++i]);
+			else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc)
+				tracePath = argv[++i];
+			else
+				configPath = argv[i];
+		}
+
+		const Config config(readFile(configPath));
+		const json &physicsConfig = config.json.at("physics");
+		const json &simConfig = config.json.at("sim");
+
+		sim::SimulationOptions options;
+
+		options.stepsCount = stepsCount > 0 ? stepsCount : simConfig.at("steps").get<size_t>();
+		options.reportInterval = simConfig.at("reportInterval").get<size_t>();
+		options.surfaceInterval = simConfig.at("surfaceInterval").get<size_t>();
+		options.timeStep = physicsConfig.at("timeStep").get<float>();
+		options.gridWidth = physicsConfig.at("gridSize").at("width").get<size_t>();
+		options.particlesCount = physicsConfig.at("particlesCount").get<size_t>();
+		options.singleThread = threadsCount > 0 ? threadsCount == 1 : config.json.at("singleThread").get<bool>();
+		options.gravity.clear();
+
+		for (const auto &keyframe : simConfig.at("gravity"))
+		{
+			const json &gravity = keyframe.at("value");
+
+			options.gravity.push_back(
+				{keyframe.at("step").get<size_t>(),
+				 glm::vec3(gravity.at(0).get<float>(), gravity.at(1).get<float>(), gravity.at(2).get<float>())});
+		}
+
+		std::sort(options.gravity.begin(), options.gravity.end(), [](const auto &a, const auto &b) {
+			return a.step < b.step;
+		});
+
+		physics::Options physicsOptions;
+
+		physicsOptions.resolveMode = physicsConfig.at("resolveMode").get<std::string>() == "batched"
+										 ? physics::ResolveMode::Batched
+										 : physics::ResolveMode::Colored;
+		physicsOptions.reorderInterval = physicsConfig.at("reorderInterval").get<size_t>();
+		physicsOptions.deterministic = physicsConfig.at("deterministic").get<bool>();
+		physicsOptions.seed = physicsConfig.at("seed").get<uint32_t>();
+		physicsOptions.solverIterations = physicsConfig.at("solverIterations").at("initial").get<size_t>();
+
+		const json &renderConfig = config.json.at("render");
+		IsosurfaceOptions isosurfaceOptions;
+
+		if (renderConfig.at("mode").get<std::string>() == "surfaceNets")
+			isosurfaceOptions.extractionMode = ExtractionMode::SurfaceNets;
+
+		if (renderConfig.at("normals").get<std::string>() == "analytic")
+			isosurfaceOptions.normalsMode = NormalsMode::Analytic;
+
+		isosurfaceOptions.incremental = renderConfig.at("incremental").get<bool>();
+		isosurfaceOptions.moveThreshold = renderConfig.at("moveThreshold").get<float>();
+		// There is no camera here, so the distances count from the view point default, the field origin.
+		isosurfaceOptions.lod = renderConfig.at("lod").get<bool>();
+		isosurfaceOptions.lodDistances = glm::vec2(
+			renderConfig.at("lodDistances").at(0).get<float>(), renderConfig.at("lodDistances").at(1).get<float>());
+		isosurfaceOptions.lodTolerance = renderConfig.at("lodTolerance").get<float>();
+
+		std::shared_ptr<ThreadPool> threadPool;
+
+		if (!options.singleThread)
+		{
+			const json &poolConfig = config.json.at("threadPool");
+			ThreadPoolOptions poolOptions;
+
+			poolOptions.spinCount = poolConfig.at("spinCount").get<size_t>();
+			poolOptions.yieldCount = poolConfig.at("yieldCount").get<size_t>();
+			threadPool = std::make_shared<ThreadPool>(
+				threadsCount > 0 ? threadsCount : std::thread::hardware_concurrency(), poolOptions);
+		}
+
+		Profiler &profiler = Profiler::getInstance();
+
+		profiler.setThreadName("Main");
+		profiler.setEnabled(!tracePath.empty());
+
+		sim::Simulation(options, physicsOptions, isosurfaceOptions, threadPool).run();
+
+		if (!tracePath.empty())
+		{
+			profiler.setEnabled(false);
+			profiler.writeTrace(tracePath);
+			info(fmt::format("Trace written to '{}'", tracePath));
+		}
+
+		return 0;
+	}
+	catch (const std::exception &ex)
+	{
+		error(fmt::format("Error occurred: {}", ex.what()));
+
+		return 1;
+	}
+}
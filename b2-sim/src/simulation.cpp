@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <limits>
+
+#include <b2/logger.hpp>
+
+#include "simulation.hpp"
+#include "timer.hpp"
+
+namespace b2::sim
+{
+
+Simulation::Simulation(
+	const SimulationOptions &options, const physics::Options &physicsOptions,
+	const IsosurfaceOptions &isosurfaceOptions, std::shared_ptr<ThreadPool> threadPool)
+	: options(options),
+	  // The desktop window is square, so is the grid the game derives from it.
+	  gridSize(int32_t(options.gridWidth)),
+	  threadPool(std::move(threadPool)),
+	  surfacesCount(0),
+	  surfaceMs(0.0f)
+{
+	const glm::ivec3 gridSize = this->gridSize;
+
+	// Same initial layout as the particles game.
+	particlesCloud = physics::ParticleCloud(
+		gridSize, options.particlesCount,
+		[gridSize](size_t idx) -> physics::Particle {
+			auto square = gridSize.x * gridSize.y;
+			auto x = (idx % square) % gridSize.x, y = (idx % square) / gridSize.x, z = idx / square;
+
+			return physics::Particle(glm::vec3 {x, z * 2.0f, y} + glm::vec3 {0.5f, 0.5f, 0.5f});
+		},
+		this->threadPool, physicsOptions);
+
+	if (options.surfaceInterval > 0)
+		isosurface = Isosurface(gridSize + glm::ivec3(margin), this->threadPool, isosurfaceOptions);
+}
+
+void Simulation::run()
+{
+	info(fmt::format(
+		"Simulating {} particles in a {}^3 grid for {} steps of {} s, {}", options.particlesCount,
+		options.gridWidth, options.stepsCount, options.timeStep,
+		options.singleThread ? std::string("single thread")
+							 : fmt::format("{} pool threads", threadPool->getWorkersCount())));
+
+	Timer totalTimer, reportTimer;
+
+	for (size_t step = 0; step < options.stepsCount; ++step)
+	{
+		particlesCloud.update(getGravity(step), options.timeStep, options.singleThread);
+
+		if (options.surfaceInterval > 0 && (step + 1) % options.surfaceInterval == 0)
+		{
+			Timer surfaceTimer;
+
+			isosurface.generateMesh<radius>(particlesCloud.getParticles(), options.singleThread);
+			surfaceMs += surfaceTimer.getDeltaMs();
+			++surfacesCount;
+		}
+
+		if ((options.reportInterval > 0 && (step + 1) % options.reportInterval == 0) ||
+			step + 1 == options.stepsCount)
+			report(step + 1, reportTimer.getDeltaMs());
+	}
+
+	const float totalMs = totalTimer.getDeltaMs();
+
+	info(fmt::format(
+		"Done in {:.1f} s, {:.1f} steps/s", totalMs * 1e-3f,
+		float(options.stepsCount) * 1e3f / std::max(totalMs, std::numeric_limits<float>::min())));
+}
+
+glm::vec3 Simulation::getGravity(size_t step) const
+{
+	const auto &keyframes = options.gravity;
+
+	if (keyframes.empty())
+		return glm::vec3(0.0f);
+
+	auto next = std::upper_bound(keyframes.begin(), keyframes.end(), step, [](size_t step, const auto &keyframe) {
+		return step < keyframe.step;
+	});
+
+	if (next == keyframes.begin())
+		return next->gravity;
+
+	if (next == keyframes.end())
+		return keyframes.back().gravity;
+
+	const auto &previous = *(next - 1);
+	const float t = float(step - previous.step) / float(next->step - previous.step);
+
+	return glm::mix(previous.gravity, next->gravity, t);
+}
+
+ParticleStats Simulation::getStats() const
+{
+	const std::vector<physics::Particle> &particles = particlesCloud.getParticles();
+	const glm::vec3 boxSize(gridSize);
+	ParticleStats stats;
+
+	stats.min = glm::vec3(std::numeric_limits<float>::max());
+	stats.max = glm::vec3(std::numeric_limits<float>::lowest());
+
+	for (const auto &particle : particles)
+	{
+		if (!particle.active)
+			continue;
+
+		const float speed = glm::length(particle.delta) / options.timeStep;
+
+		++stats.activeCount;
+		stats.center += particle.position;
+		stats.min = glm::min(stats.min, particle.position);
+		stats.max = glm::max(stats.max, particle.position);
+		stats.meanSpeed += speed;
+		stats.maxSpeed = std::max(stats.maxSpeed, speed);
+
+		if (glm::any(glm::lessThan(particle.position, glm::vec3(0.0f))) ||
+			glm::any(glm::greaterThan(particle.position, boxSize)))
+			++stats.outsideCount;
+	}
+
+	if (stats.activeCount == 0)
+		return {};
+
+	stats.center /= float(stats.activeCount);
+	stats.meanSpeed /= float(stats.activeCount);
+
+	return stats;
+}
+
+void Simulation::report(size_t step, float elapsedMs)
+{
+	const physics::Timings &timings = particlesCloud.getTimings();
+	const float stepsCount = float(std::max<size_t>(timings.stepsCount, 1));
+	const ParticleStats stats = getStats();
+	const glm::vec3 gravity = getGravity(step - 1);
+
+	info(fmt::format(
+		"Step {}: gravity ({:.2f}, {:.2f}, {:.2f}), {} active, {} outside, center ({:.1f}, {:.1f}, {:.1f}), "
+		"bounds ({:.1f}, {:.1f}, {:.1f}) - ({:.1f}, {:.1f}, {:.1f}), speed {:.2f} mean, {:.2f} max",
+		step, gravity.x, gravity.y, gravity.z, stats.activeCount, stats.outsideCount, stats.center.x,
+		stats.center.y, stats.center.z, stats.min.x, stats.min.y, stats.min.z, stats.max.x, stats.max.y,
+		stats.max.z, stats.meanSpeed, stats.maxSpeed));
+	info(fmt::format(
+		"Per step: move {:.3f} ms, bounds {:.3f} ms, fill {:.3f} ms, resolve {:.3f} ms, reorder {:.3f} ms, "
+		"wall {:.3f} ms",
+		timings.move / stepsCount, timings.bounds / stepsCount, timings.fill / stepsCount,
+		timings.resolve / stepsCount, timings.reorder / stepsCount, elapsedMs / stepsCount));
+
+	if (surfacesCount > 0)
+	{
+		const Isosurface::Mesh &mesh = isosurface.getMesh();
+
+		info(fmt::format(
+			"Surface: {:.3f} ms per mesh, {} vertices, {} triangles", surfaceMs / float(surfacesCount),
+			mesh.vertices.size(), mesh.indices.size() / 3));
+	}
+
+	particlesCloud.resetTimings();
+	surfacesCount = 0;
+	surfaceMs = 0.0f;
+}
+
+} // namespace b2::sim
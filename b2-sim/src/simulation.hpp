@@ -0,0 +1,71 @@
+#pragma once
+
+#include <memory>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "isosurface.hpp"
+#include "physics.hpp"
+#include "threadpool.hpp"
+
+namespace b2::sim
+{
+
+struct GravityKeyframe
+{
+	size_t step;
+	glm::vec3 gravity;
+};
+
+struct SimulationOptions
+{
+	size_t stepsCount = 1000;
+	// Steps between two reports; zero reports only once all steps ran.
+	size_t reportInterval = 100;
+	// Steps between two isosurface meshes; zero disables them.
+	size_t surfaceInterval = 0;
+	float timeStep = 0.01f;
+	size_t gridWidth = 80, particlesCount = 128000;
+	// Gravity is interpolated linearly between keyframes sorted by step and held past the last one.
+	std::vector<GravityKeyframe> gravity = {{0, glm::vec3(0.0f, -9.81f, 0.0f)}};
+	bool singleThread = true;
+};
+
+struct ParticleStats
+{
+	size_t activeCount = 0, outsideCount = 0;
+	glm::vec3 center {0.0f}, min {0.0f}, max {0.0f};
+	// In grid cells per second.
+	float meanSpeed = 0.0f, maxSpeed = 0.0f;
+};
+
+// Runs ParticleCloud without a window: steps it under the gravity schedule and logs phase timings and particle
+// statistics every reportInterval steps.
+class Simulation
+{
+public:
+	Simulation(
+		const SimulationOptions &options, const physics::Options &physicsOptions,
+		const IsosurfaceOptions &isosurfaceOptions, std::shared_ptr<ThreadPool> threadPool);
+
+	void run();
+
+	[[nodiscard]] glm::vec3 getGravity(size_t step) const;
+	[[nodiscard]] ParticleStats getStats() const;
+
+	static const uint32_t radius = 2, margin = (radius + 1) * 2;
+
+private:
+	void report(size_t step, float elapsedMs);
+
+	SimulationOptions options;
+	glm::ivec3 gridSize;
+	physics::ParticleCloud particlesCloud;
+	Isosurface isosurface;
+	std::shared_ptr<ThreadPool> threadPool;
+	size_t surfacesCount;
+	float surfaceMs;
+};
+
+} // namespace b2::sim
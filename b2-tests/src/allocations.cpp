@@ -0,0 +1,166 @@
+#include <algorithm>
+#include <atomic>
+#include <cstdlib>
+#include <latch>
+#include <new>
+
+#include <fmt/format.h>
+
+#include "check.hpp"
+#include "physics.hpp"
+#include "threadpool.hpp"
+
+// Every heap allocation of the process goes through these while counting is on.
+static std::atomic_bool counting(false);
+static std::atomic<size_t> allocationsCount(0);
+
+static void *allocate(size_t size, size_t alignment)
+{
+	if (counting.load(std::memory_order_relaxed))
+		allocationsCount.fetch_add(1, std::memory_order_relaxed);
+
+	const size_t bytes = std::max<size_t>(size, 1);
+	void *pointer = nullptr;
+
+	// aligned_alloc wants a size multiple of the alignment.
+	if (alignment > alignof(std::max_align_t))
+		pointer = std::aligned_alloc(alignment, (bytes + alignment - 1) / alignment * alignment);
+	else
+		pointer = std::malloc(bytes);
+
+	if (pointer == nullptr)
+		throw std::bad_alloc();
+
+	return pointer;
+}
+
+void *operator new(size_t size)
+{
+	return allocate(size, 0);
+}
+
+void *operator new[](size_t size)
+{
+	return allocate(size, 0);
+}
+
+void *operator new(size_t size, std::align_val_t alignment)
+{
+	return allocate(size, size_t(alignment));
+}
+
+void *operator new[](size_t size, std::align_val_t alignment)
+{
+	return allocate(size, size_t(alignment));
+}
+
+void operator delete(void *pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept
+{
+	std::free(pointer);
+}
+
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept
+{
+	std::free(pointer);
+}
+
+// Once warmed up, threaded physics steps and caller-owned pool tasks run without a single heap allocation.
+int main()
+{
+	using namespace b2;
+	using namespace b2::tests;
+
+	const size_t stepsCount = 50, tasksCount = 1000;
+	const glm::ivec3 gridSize(32);
+	auto threadPool = std::make_shared<ThreadPool>(4);
+
+	for (physics::ResolveMode resolveMode : {physics::ResolveMode::Colored, physics::ResolveMode::Batched})
+	{
+		physics::Options options;
+
+		options.resolveMode = resolveMode;
+		options.reorderInterval = 7;
+
+		physics::ParticleCloud cloud(
+			gridSize, 16000,
+			[&gridSize](size_t idx) -> physics::Particle {
+				auto square = gridSize.x * gridSize.y;
+				auto x = (idx % square) % gridSize.x, y = (idx % square) / gridSize.x, z = idx / square;
+
+				return physics::Particle(glm::vec3 {x, z * 2.0f, y} + glm::vec3 {0.5f, 0.5f, 0.5f});
+			},
+			threadPool, options);
+
+		// The first steps size the scratch buffers and the pool's thread-local state.
+		for (size_t i = 0; i < options.reorderInterval + 1; ++i)
+			cloud.update(glm::vec3(0.0f, -9.81f, 0.0f), 0.01f, false);
+
+		allocationsCount.store(0);
+		counting.store(true);
+
+		for (size_t i = 0; i < stepsCount; ++i)
+			cloud.update(glm::vec3(0.0f, -9.81f, 0.0f), 0.01f, false);
+
+		counting.store(false);
+		check(
+			allocationsCount.load() == 0,
+			fmt::format(
+				"{} resolve: {} allocations over {} steps",
+				resolveMode == physics::ResolveMode::Colored ? "colored" : "batched", allocationsCount.load(),
+				stepsCount));
+	}
+
+	std::atomic<size_t> runsCount(0);
+
+	allocationsCount.store(0);
+	counting.store(true);
+
+	for (size_t i = 0; i < tasksCount; ++i)
+	{
+		std::latch latch(2);
+		Task first([&runsCount]() { runsCount.fetch_add(1, std::memory_order_relaxed); }, &latch),
+			second([&runsCount]() { runsCount.fetch_add(1, std::memory_order_relaxed); }, &latch);
+
+		threadPool->pushTask(first);
+		threadPool->pushTask(second);
+		threadPool->wait(latch);
+	}
+
+	counting.store(false);
+	check(runsCount.load() == tasksCount * 2, fmt::format("{} of {} tasks ran", runsCount.load(), tasksCount * 2));
+	check(
+		allocationsCount.load() == 0,
+		fmt::format("{} allocations over {} caller-owned tasks", allocationsCount.load(), tasksCount * 2));
+
+	return getResult();
+}
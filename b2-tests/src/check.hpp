@@ -0,0 +1,30 @@
+#pragma once
+
+#include <iostream>
+#include <string>
+
+namespace b2::tests
+{
+
+inline size_t failuresCount = 0;
+
+// Reports a failed check and lets the test go on, so one run lists every failure.
+inline void check(bool condition, const std::string &message)
+{
+	if (!condition)
+	{
+		std::cerr << "FAILED: " << message << '\n';
+		++failuresCount;
+	}
+}
+
+// Exit status of the test.
+inline int getResult()
+{
+	if (failuresCount == 0)
+		std::cout << "passed\n";
+
+	return failuresCount == 0 ? 0 : 1;
+}
+
+} // namespace b2::tests
@@ -0,0 +1,125 @@
+#include <cmath>
+#include <numeric>
+#include <random>
+
+#include <fmt/format.h>
+
+#include "check.hpp"
+#include "physics.hpp"
+
+namespace b2::tests
+{
+
+// ParticleCloud::resolveParticles as it was before the collision kernels, with the hashed direction for coincident
+// particles in place of glm::sphericalRand.
+void resolveParticles(physics::Particle &p1, physics::Particle &p2, size_t i1, size_t i2, uint32_t seed)
+{
+	auto pushParticle = [](physics::Particle &p, const glm::vec3 &v) {
+		p.position += v;
+		p.delta += v;
+	};
+	glm::vec3 pv = p1.position - p2.position;
+	float distance = glm::length(pv), bounce = 0.5f;
+
+	if (distance < 1.0f)
+	{
+		float depth = (1.0f - distance) * 0.5f;
+
+		if (distance == 0.0f)
+			pv = physics::collision::getCoincidentDirection(i1, i2, seed);
+		else
+			pv /= distance;
+
+		pushParticle(p1, pv * depth);
+		pushParticle(p2, pv * -depth);
+
+		float exchange = ((1.0f + bounce) * glm::dot(p1.delta - p2.delta, pv)) * 0.5f;
+
+		if (exchange > 1.0f)
+		{
+			p1.delta += pv * exchange;
+			p2.delta -= pv * exchange;
+		}
+	}
+}
+
+} // namespace b2::tests
+
+// Every collision kernel must match the original pairwise routine within collision::tolerance for one call, on
+// batches of every length including partial vector tails, with coincident particles among the candidates.
+int main()
+{
+	using namespace b2;
+	using namespace b2::physics;
+	using namespace b2::tests;
+
+	const InstructionSet instructionSet = detectInstructionSet();
+	std::vector<std::pair<const char *, collision::Kernel>> kernels = {{"scalar", collision::resolveScalar}};
+
+	if (instructionSet >= InstructionSet::SSE2)
+		kernels.emplace_back("SSE2", collision::resolveSSE2);
+
+	if (instructionSet >= InstructionSet::AVX2)
+		kernels.emplace_back("AVX2", collision::resolveAVX2);
+
+	std::cout << fmt::format("Checking {} kernel(s) against the pairwise routine\n", kernels.size());
+
+	std::mt19937 generator(7);
+	std::uniform_real_distribution<float> position(0.0f, 3.0f), delta(-0.05f, 0.05f);
+
+	for (size_t trial = 0; trial < 2000; ++trial)
+	{
+		const size_t particlesCount = 1 + trial % 40;
+		ParticleStorage particles(particlesCount);
+		std::vector<Particle> expected;
+
+		for (size_t i = 0; i < particlesCount; ++i)
+		{
+			Particle particle(glm::vec3(position(generator), position(generator), position(generator)));
+
+			particle.delta = glm::vec3(delta(generator), delta(generator), delta(generator));
+
+			// Every fourth particle sits exactly on the previous one.
+			if (i % 4 == 3)
+				particle.position = expected.back().position;
+
+			particles.set(i, particle);
+			expected.push_back(particle);
+		}
+
+		std::vector<uint32_t> candidates(particlesCount);
+
+		std::iota(candidates.begin(), candidates.end(), 0);
+		std::shuffle(candidates.begin(), candidates.end(), generator);
+
+		const size_t index = trial % particlesCount;
+		const uint32_t seed = uint32_t(trial);
+
+		for (uint32_t other : candidates)
+			if (other != index)
+				resolveParticles(expected[index], expected[other], index, other, seed);
+
+		for (const auto &[name, kernel] : kernels)
+		{
+			ParticleStorage actual = particles;
+
+			kernel(actual, index, candidates.data(), candidates.size(), seed);
+
+			for (size_t i = 0; i < particlesCount; ++i)
+			{
+				const glm::vec3 positionError = glm::abs(actual.getPosition(i) - expected[i].position),
+								deltaError = glm::abs(actual.getDelta(i) - expected[i].delta);
+				const float error = std::max(
+					glm::max(positionError.x, glm::max(positionError.y, positionError.z)),
+					glm::max(deltaError.x, glm::max(deltaError.y, deltaError.z)));
+
+				check(
+					error <= collision::tolerance,
+					fmt::format(
+						"{} kernel, trial {}, particle {} of {}: off by {}", name, trial, i, particlesCount, error));
+			}
+		}
+	}
+
+	return getResult();
+}
@@ -0,0 +1,154 @@
+#include <cmath>
+#include <random>
+
+#include <fmt/format.h>
+
+#include "check.hpp"
+#include "isosurface.hpp"
+
+struct Particle
+{
+	glm::vec3 position;
+};
+
+namespace b2::tests
+{
+
+struct IsosurfaceProbe
+{
+	// Largest difference between the values and normals of two fields.
+	static float getFieldError(const Isosurface &a, const Isosurface &b)
+	{
+		float error = 0.0f;
+
+		for (size_t i = 0; i < std::min(a.field.size(), b.field.size()); ++i)
+		{
+			const glm::vec3 normalError = glm::abs(a.field[i].normal - b.field[i].normal);
+
+			error = std::max(
+				{error, std::abs(a.field[i].value - b.field[i].value), normalError.x, normalError.y, normalError.z});
+		}
+
+		return error;
+	}
+
+	// The last update re-splatted only some of the bricks instead of falling back to a full regeneration.
+	static bool isPatched(const Isosurface &isosurface)
+	{
+		return !isosurface.dirtyBricks.empty() && isosurface.dirtyBricks.size() < isosurface.activeBricks.size();
+	}
+};
+
+static const uint32_t radius = 2;
+static const float tolerance = 1e-4f;
+
+// Largest difference between the positions and normals of two vertex lists.
+float getVerticesError(const std::vector<Isosurface::MeshVertex> &a, const std::vector<Isosurface::MeshVertex> &b)
+{
+	float error = 0.0f;
+
+	for (size_t i = 0; i < std::min(a.size(), b.size()); ++i)
+	{
+		const glm::vec3 positionError = glm::abs(a[i].position - b[i].position),
+						normalError = glm::abs(a[i].normal - b[i].normal);
+
+		error = std::max(
+			{error, positionError.x, positionError.y, positionError.z, normalError.x, normalError.y, normalError.z});
+	}
+
+	return error;
+}
+
+// Runs a few frames in incremental mode and compares each with a full regeneration from the splatted positions.
+void checkFrames(
+	const std::string &name, const glm::ivec3 &fieldSize, const std::vector<Particle> &splatted,
+	const IsosurfaceOptions &options, std::shared_ptr<ThreadPool> threadPool)
+{
+	const size_t framesCount = 4, movedCount = 3;
+	const bool singleThread = threadPool == nullptr;
+
+	std::mt19937 generator(5);
+	std::uniform_real_distribution<float> jitter(-0.1f, 0.1f), move(1.0f, 3.0f);
+	std::uniform_int_distribution<size_t> pick(0, splatted.size() - 1);
+	IsosurfaceOptions incrementalOptions = options;
+
+	incrementalOptions.incremental = true;
+	incrementalOptions.moveThreshold = 0.25f;
+
+	Isosurface incremental(fieldSize, threadPool, incrementalOptions);
+	std::vector<Particle> particles = splatted, reference = splatted;
+
+	incremental.generateMesh<radius>(particles, singleThread);
+
+	for (size_t frame = 1; frame <= framesCount; ++frame)
+	{
+		const std::string frameName = fmt::format("{}, frame {}", name, frame);
+
+		// Every particle strays from where it was splatted by less than the threshold, and a few jump well beyond it.
+		for (size_t i = 0; i < particles.size(); ++i)
+			particles[i].position =
+				reference[i].position + glm::vec3(jitter(generator), jitter(generator), jitter(generator));
+
+		for (size_t m = 0; m < movedCount; ++m)
+		{
+			const size_t i = pick(generator);
+
+			particles[i].position += glm::vec3(move(generator), -move(generator), move(generator));
+			reference[i] = particles[i];
+		}
+
+		Isosurface full(fieldSize, threadPool, options);
+		const Isosurface::Mesh &actual = incremental.generateMesh<radius>(particles, singleThread),
+							   &expected = full.generateMesh<radius>(reference, singleThread);
+		const float fieldError = IsosurfaceProbe::getFieldError(incremental, full),
+					verticesError = getVerticesError(actual.vertices, expected.vertices);
+
+		check(IsosurfaceProbe::isPatched(incremental), frameName + ": the whole field was regenerated");
+		check(fieldError <= tolerance, fmt::format("{}: fields off by {}", frameName, fieldError));
+		check(actual.indices == expected.indices, frameName + ": mesh indices differ");
+		check(
+			actual.vertices.size() == expected.vertices.size(),
+			fmt::format("{}: {} vertices instead of {}", frameName, actual.vertices.size(), expected.vertices.size()));
+		check(verticesError <= tolerance, fmt::format("{}: vertices off by {}", frameName, verticesError));
+	}
+}
+
+} // namespace b2::tests
+
+// An incremental update that re-splats and re-extracts the bricks around a few moved particles must give the field
+// and mesh of a full regeneration from the positions it splatted, that is with the moves below the threshold left
+// out. Both sum the same contributions in a different order, hence the tolerance.
+int main()
+{
+	using namespace b2;
+	using namespace b2::tests;
+
+	const glm::ivec3 fieldSize(40, 34, 46);
+
+	std::mt19937 generator(5);
+	std::uniform_real_distribution<float> x(-4.0f, 44.0f), y(-4.0f, 20.0f), z(-4.0f, 50.0f);
+	std::vector<Particle> particles(6000);
+
+	for (auto &particle : particles)
+		particle.position = glm::vec3(x(generator), y(generator), z(generator));
+
+	for (NormalsMode normalsMode : {NormalsMode::Sampled, NormalsMode::Analytic})
+		for (ExtractionMode extractionMode : {ExtractionMode::MarchingCubes, ExtractionMode::SurfaceNets})
+			for (size_t threadsCount : {0, 4})
+			{
+				IsosurfaceOptions options;
+
+				options.normalsMode = normalsMode;
+				options.extractionMode = extractionMode;
+
+				checkFrames(
+					fmt::format(
+						"{} normals, {}, {} worker(s)", normalsMode == NormalsMode::Sampled ? "sampled" : "analytic",
+						extractionMode == ExtractionMode::MarchingCubes ? "marching cubes" : "surface nets",
+						threadsCount),
+					fieldSize, particles, options,
+					threadsCount == 0 ? nullptr : std::make_shared<ThreadPool>(threadsCount));
+			}
+
+	return getResult();
+}
@@ -0,0 +1,95 @@
+#include <cstring>
+#include <random>
+
+#include <fmt/format.h>
+
+#include "check.hpp"
+#include "isosurface.hpp"
+
+namespace b2::tests
+{
+
+struct IsosurfaceProbe
+{
+	template<uint32_t Radius, typename Particle>
+	static const auto &generateScalarField(
+		Isosurface &isosurface, const std::vector<Particle> &particles, bool singleThread)
+	{
+		isosurface.generateScalarField<Radius>(particles, singleThread);
+
+		return isosurface.field;
+	}
+};
+
+template<typename T>
+bool isEqual(const std::vector<T> &a, const std::vector<T> &b)
+{
+	return a.size() == b.size() && std::memcmp(a.data(), b.data(), a.size() * sizeof(T)) == 0;
+}
+
+} // namespace b2::tests
+
+struct Particle
+{
+	glm::vec3 position;
+};
+
+// The parallel splat must not depend on scheduling: fields and meshes built on pools of any size match the
+// single-threaded ones byte for byte, with some particles outside the field.
+int main()
+{
+	using namespace b2;
+	using namespace b2::tests;
+
+	static const uint32_t radius = 2;
+	const glm::ivec3 fieldSize(40, 34, 46);
+
+	std::mt19937 generator(11);
+	std::uniform_real_distribution<float> x(-4.0f, 44.0f), y(-4.0f, 20.0f), z(-4.0f, 50.0f);
+	std::vector<Particle> particles(20000);
+
+	for (auto &particle : particles)
+		particle.position = glm::vec3(x(generator), y(generator), z(generator));
+
+	for (NormalsMode normalsMode : {NormalsMode::Sampled, NormalsMode::Analytic})
+		for (ExtractionMode extractionMode : {ExtractionMode::MarchingCubes, ExtractionMode::SurfaceNets})
+			for (bool lod : {false, true})
+			{
+				// Only surface nets has levels of detail. Close distances mix all three levels within the field.
+				if (lod && extractionMode != ExtractionMode::SurfaceNets)
+					continue;
+
+				IsosurfaceOptions options;
+
+				options.normalsMode = normalsMode;
+				options.extractionMode = extractionMode;
+				options.lod = lod;
+				options.lodDistances = glm::vec2(12.0f, 24.0f);
+
+				Isosurface reference(fieldSize, nullptr, options);
+				const auto field = IsosurfaceProbe::generateScalarField<radius>(reference, particles, true);
+				const Isosurface::Mesh mesh = reference.generateMesh<radius>(particles, true);
+
+				check(!mesh.indices.empty(), "the reference mesh is empty");
+
+				for (size_t threadsCount : {1, 2, 4, 7})
+				{
+					const std::string name = fmt::format(
+						"{} normals, {}{}, {} thread(s)", normalsMode == NormalsMode::Sampled ? "sampled" : "analytic",
+						extractionMode == ExtractionMode::MarchingCubes ? "marching cubes" : "surface nets",
+						lod ? " with LOD" : "", threadsCount);
+					Isosurface isosurface(fieldSize, std::make_shared<ThreadPool>(threadsCount), options);
+
+					check(
+						isEqual(IsosurfaceProbe::generateScalarField<radius>(isosurface, particles, false), field),
+						name + ": fields differ");
+
+					const Isosurface::Mesh &actual = isosurface.generateMesh<radius>(particles, false);
+
+					check(isEqual(actual.vertices, mesh.vertices), name + ": mesh vertices differ");
+					check(isEqual(actual.indices, mesh.indices), name + ": mesh indices differ");
+				}
+			}
+
+	return getResult();
+}